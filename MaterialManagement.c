@@ -1,11 +1,24 @@
+// Build: cc -std=c11 -pthread -o MaterialManagement MaterialManagement.c -lm
+// -pthread for the report worker and the replica tailer, -lm for exp().
+#define _POSIX_C_SOURCE 200809L // pread, posix_fadvise
+
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 // escape sequence for terminal color
 #define RED "\033[31m"
@@ -19,13 +32,25 @@
 
 #define MAX_LIST_SIZE 100
 #define MAX_TRANS_SIZE 500
+#define MAX_UNITS 32
+
+// codes of the units every dictionary starts with
+enum { UNIT_PCS, UNIT_KG, UNIT_M, UNIT_L, UNIT_BOTTLE };
+
+typedef struct {
+  int count;
+  char names[MAX_UNITS][10];
+} UnitDictionary;
 
 typedef struct {
   char matId[10];
   char name[50];
-  int qty; // quantity in storage
-  char unit[10];
-  int status; // 1. active | 0. expired
+  int qty;                // quantity in storage
+  unsigned char unitCode; // index into the unit dictionary
+  int status;             // 1. active | 0. expired
+  unsigned char deleted;  // tombstone, dropped by the next compaction
+  float usage;            // OUT qty, exponentially decayed to lastActivity
+  int64_t lastActivity;   // time of the last movement, 0 = never
 } Material;
 
 typedef struct {
@@ -35,43 +60,544 @@ typedef struct {
   char date[15]; // transaction time
 } Transaction;
 
+// material slots sorted by case-folded key, for prefix completion
+#define COMPLETION_LIMIT 5
+
+typedef struct {
+  int count;
+  int byId[MAX_LIST_SIZE];
+  int byName[MAX_LIST_SIZE];
+} PrefixIndex;
+
+// Versioned snapshots: the tables are copied into refcounted pages that
+// never change once published. A new version copies only the dirty pages
+// and shares the rest, readers hold a version for as long as they need.
+#define SNAPSHOT_PAGE_ROWS 16
+#define MATERIAL_PAGES                                                         \
+  ((MAX_LIST_SIZE + SNAPSHOT_PAGE_ROWS - 1) / SNAPSHOT_PAGE_ROWS)
+#define TRANSACTION_PAGES                                                      \
+  ((MAX_TRANS_SIZE + SNAPSHOT_PAGE_ROWS - 1) / SNAPSHOT_PAGE_ROWS)
+
+typedef struct {
+  int refs;
+  Material rows[SNAPSHOT_PAGE_ROWS];
+} MaterialPage;
+
+typedef struct {
+  int refs;
+  Transaction rows[SNAPSHOT_PAGE_ROWS];
+} TransactionPage;
+
+typedef struct {
+  int refs;
+  long version;
+  int materialCount;
+  int transactionCount;
+  MaterialPage *materialPages[MATERIAL_PAGES];
+  TransactionPage *transactionPages[TRANSACTION_PAGES];
+} Snapshot;
+
+typedef struct {
+  pthread_mutex_t lock; // guards current
+  Snapshot *current;
+  // writer side only
+  bool materialDirty[MATERIAL_PAGES];
+  int transactionDirtyFrom; // first changed transaction row
+} SnapshotStore;
+
+// a list to page through, rows come from an array or a snapshot
+typedef struct {
+  int count;
+  Material *(*rowAt)(void *source, int i);
+  void *source;
+  const int *slots; // row i is slots[i] of the source, NULL -> row i
+} MaterialView;
+
+// reports written to a file by the worker thread
+#define MAX_JOBS 16
+
+typedef enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE, JOB_FAILED } JobState;
+typedef enum { REPORT_INVENTORY, REPORT_MOVEMENT } ReportKind;
+
+typedef struct {
+  int id; // 0 -> free slot
+  ReportKind kind;
+  int warehouse; // index into warehouses
+  JobState state;
+  int done; // rows written so far
+  int total;
+  char path[256];
+  Snapshot *snap; // taken at submit time
+} ReportJob;
+
+typedef struct {
+  pthread_mutex_t lock; // guards everything below
+  pthread_cond_t wake;
+  pthread_t worker;
+  bool started;
+  bool stopping;
+  int nextId;
+  ReportJob jobs[MAX_JOBS];
+} JobQueue;
+
+// one parsed line of a movement file
+typedef struct {
+  int materialIdx;
+  int type; // 1: import | 2: export
+  int qty;
+  int line;
+} Movement;
+
+// catalog file layout:
+// CatalogHeader | Material[MAX_LIST_SIZE] | Transaction[MAX_TRANS_SIZE]
+#define CATALOG_MAGIC "MMCATLG"
+#define CATALOG_VERSION 6
+
+// A bulk apply parks every material row it changes in the header before
+// touching the table. Storing stagedCount is its commit point: a catalog
+// opened with a nonzero stagedCount finishes the batch first.
+typedef struct {
+  int slot;
+  Material row;
+} StagedRow;
+
+// A stock move between two warehouses writes both sides' new state into
+// the header of one mapped catalog. Setting committed is its commit point;
+// startup finishes a committed move once every warehouse is open.
+typedef struct {
+  char code[10]; // warehouse
+  int slot;
+  Material row;
+  int materialCount;
+  int transactionCount;
+} MoveSide;
+
+typedef struct {
+  int committed;
+  MoveSide sides[2]; // source, destination
+} PendingMove;
+
+typedef struct {
+  char magic[8];
+  int version;
+  int materialSize;    // sizeof(Material) the file was written with
+  int transactionSize; // sizeof(Transaction) the file was written with
+  int materialCapacity;
+  int transactionCapacity;
+  int materialCount;
+  int transactionCount;
+  UnitDictionary units;
+  int stagedCount;            // 0 unless a bulk apply is in flight
+  int stagedTransactionCount; // transaction count the batch ends with
+  StagedRow staged[MAX_LIST_SIZE];
+  PendingMove move;
+} CatalogHeader;
+
+typedef struct {
+  int fd;
+  size_t size;
+  CatalogHeader *header; // NULL -> tables live on the heap
+  int materialCapacity;  // heap rows known to be allocated
+  int transactionCapacity;
+} MappedCatalog;
+
+// Bitmap indexes over low-cardinality attributes, one bit per material
+// slot. Filters combine with AND/OR, counts are popcounts, and page n of a
+// filtered list starts at select(n * pageSize).
+#define BITMAP_WORDS ((MAX_LIST_SIZE + 63) / 64)
+#define REORDER_POINT 50 // qty below this counts as low stock
+
+typedef struct {
+  uint64_t words[BITMAP_WORDS];
+} Bitmap;
+
+typedef struct {
+  Bitmap live;
+  Bitmap active;
+  Bitmap expired;
+  Bitmap lowStock;
+  Bitmap unit[MAX_UNITS];
+} BitmapIndex;
+
+// A filter expression such as `qty < 50 AND name contains "bolt"` compiles
+// to a plan once. Numeric predicates (qty, status, unit) run first over
+// 64-row blocks. String predicates (id, name) run only on rows that are
+// still in the block mask.
+#define MAX_PREDICATES 8
+#define FILTER_BLOCK_ROWS 64
+
+typedef enum {
+  FIELD_QTY,
+  FIELD_STATUS,
+  FIELD_UNIT,
+  FIELD_ID,
+  FIELD_NAME
+} FilterField;
+typedef enum { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE, OP_CONTAINS } FilterOp;
+
+typedef struct {
+  FilterField field;
+  FilterOp op;
+  int number; // qty, status or unit code
+  char text[50];
+} Predicate;
+
+typedef struct {
+  int numericCount;
+  Predicate numeric[MAX_PREDICATES];
+  int stringCount;
+  Predicate strings[MAX_PREDICATES];
+} FilterPlan;
+
+// Each warehouse is a shard: its own tables, catalog file, indexes and
+// snapshots. Transaction IDs and the unit dictionary are shared.
+#define MAX_WAREHOUSES 8
+
+// compaction starts at this many tombstones (or a quarter of the table)
+// and moves at most COMPACT_STEP_ROWS rows per command
+#define COMPACT_MIN_TOMBSTONES 4
+#define COMPACT_STEP_ROWS 16
+
+#define SECONDS_PER_DAY 86400.0
+#define CONSUMPTION_WINDOW_DAYS 14.0 // weight of past usage falls by e
+
+typedef struct {
+  char code[10];
+  Material *materials;
+  int materialCount;
+  Transaction *transactions;
+  int transactionCount;
+  MappedCatalog catalog;
+  PrefixIndex index;
+  BitmapIndex bitmaps;
+  SnapshotStore snapshots;
+  // incremental compaction: rows before compactRead are done, the live ones
+  // now sit before compactWrite
+  int tombstones;
+  bool compacting;
+  int compactRead;
+  int compactWrite;
+  // rows not yet written to the journal
+  Bitmap journalPending;
+  int journaledMaterials;
+  int journaledTransactions;
+} Warehouse;
+
+// Per-command scratch memory. Transient result sets are bumped out of one
+// static block and dropped together after each command. Requests that do
+// not fit fall back to the heap.
+#define ARENA_SIZE (64 * 1024)
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  max_align_t data[];
+} ArenaBlock;
+
+// Every heap allocation the program makes itself goes through heapAlloc /
+// heapRealloc and is counted. Retired snapshots and pages are kept on
+// free lists for the next publish, and heap tables double instead of
+// growing a row at a time. Command paths read and write files with
+// read()/write(), not stdio, and dates come from localtime_r, which reads
+// TZ once instead of on every call. So the heap count only moves when the
+// tables outgrow what is already allocated, about once per snapshot page
+// of new rows; a read-only command loop leaves it unchanged.
+typedef struct PoolNode {
+  struct PoolNode *next;
+} PoolNode;
+
+typedef struct {
+  pthread_mutex_t lock; // pages are released from worker threads too
+  PoolNode *free;
+  size_t size;
+} Pool;
+
+typedef struct {
+  size_t used;
+  size_t peak;
+  ArenaBlock *overflow; // heap fallbacks, freed on reset
+  long allocations;
+  long heapFallbacks;
+  long resets;
+} Arena;
+
+// Buffered stdin: one read() pulls in a large block. Lines are handed out
+// as spans into it, NUL-terminated in place. Fields are split without
+// copying.
+#define INPUT_BLOCK_SIZE (64 * 1024)
+
+typedef struct {
+  char *start;
+  size_t len;
+} Span;
+
+typedef struct {
+  char buf[INPUT_BLOCK_SIZE];
+  size_t head; // first byte not handed out yet
+  size_t tail; // end of the bytes read so far
+  bool eof;
+} InputReader;
+
+// Mutation journal: a JournalFormat header, then per commit the row images
+// it changed and a COMMIT record. A replica process tails the file and
+// applies whole groups. Every JOURNAL_SNAPSHOT_INTERVAL commits the
+// primary also writes a snapshot with the journal offset it covers, for
+// replicas that fall too far behind.
+#define JOURNAL_SNAPSHOT_INTERVAL 64
+#define REPLICA_POLL_MS 50
+#define REPLICA_MAX_LAG_RECORDS 4096
+#define JOURNAL_MAGIC "MMJRNAL"
+#define JOURNAL_SNAPSHOT_MAGIC "MMSNAPS"
+#define JOURNAL_VERSION 1 // bump when JournalRecord or a row layout changes
+
+typedef enum {
+  JOURNAL_WAREHOUSE,   // warehouse index -> code
+  JOURNAL_UNIT,        // unit code -> name
+  JOURNAL_MATERIAL,    // one material row
+  JOURNAL_TRANSACTION, // one transaction row
+  JOURNAL_COUNTS,      // table sizes of one warehouse
+  JOURNAL_COMMIT       // end of a group
+} JournalKind;
+
+typedef struct {
+  int kind;
+  int warehouse;
+  int slot;        // row index, unit code or material count
+  int count;       // transaction count
+  long long stamp; // primary's wall clock in ms (COMMIT)
+  union {
+    Material material;
+    Transaction transaction;
+    char text[10];
+  } row;
+} JournalRecord;
+
+// starts the journal and its snapshot file; a reader refuses any other
+// format, since records are raw structs
+typedef struct {
+  char magic[8];
+  int version;
+  int recordSize;
+  int materialSize;
+  int transactionSize;
+} JournalFormat;
+
+typedef struct {
+  JournalFormat format;
+  long journalOffset; // journal bytes this snapshot already contains
+  int warehouseCount;
+  UnitDictionary units;
+} JournalSnapshotHeader;
+
+typedef struct {
+  const char *path;
+  char snapshotPath[256];
+  pthread_t thread;
+  pthread_mutex_t lock; // held while applying a group or answering a query
+  bool stopping;
+  long offset;           // journal bytes applied
+  long behind;           // journal bytes not applied at the last poll
+  long long lastStamp;   // primary clock of the last applied commit
+  int snapshotLoads;
+  bool incompatible; // the journal was written by another format
+  // journal warehouse index -> local shard, -1 until announced. A primary
+  // restarted with its warehouses in another order reuses the indexes.
+  int shardOf[MAX_WAREHOUSES];
+} Replica;
+
 // ======= PROTOTYPES =======
 void displayMenu();
 void initTestMaterialData(Material **materials, int *materialCount);
 void initTestTransData(Transaction **transactions, int *transCount);
 
+int readLine(Span *line);
+bool nextField(Span *rest, Span *field);
+bool spanIs(Span span, const char *text);
+Span trimSpan(Span span);
+bool parseInt(Span text, int *value);
 void readValidLine(char *buffer, size_t size, char *announce, char *valueType);
 void readInt(int *number, char *announce, char *valueType);
 
-void createNewMaterial(Material **materials, int *materialCount);
-void updateMaterial(Material *materials, int materialCount);
-void updateMaterialStatus(Material *materials, int materialCount);
+void createNewMaterial(Warehouse *wh);
+void updateMaterial(Warehouse *wh);
+void updateMaterialStatus(Warehouse *wh);
 int readStatusWithDefault();
-int findMaterialByID(Material *materials, int materialCount, char *target);
-void findMaterialByName(Material *materials, int materialCount, char *target);
 int findMaterialIndexById(Material *m, char *id, int materialCount);
-void findMaterialByIdOrName(Material *materials, int materialCount);
+void findMaterialByIdOrName();
 void sortMaterial(Material *materials, int materialCount);
 
+int readUnit(char *announce);
+const char *unitName(int code);
+int findUnitCode(const char *name);
+int internUnit(const char *name);
+void aggregateByUnit(Snapshot *snap, int status, long *totalQty,
+                     int *materialTotal);
+void reportQuantityByUnit();
+void displayReportMenu();
+int submitReportJob(ReportKind kind, int warehouse, const char *path);
+void queueReport(ReportKind kind);
+void displayJobs();
+void stopReportWorker();
+
+void buildPrefixIndex(PrefixIndex *index, Material *materials,
+                      int materialCount);
+void prefixIndexInsert(PrefixIndex *index, Material *materials, int slot);
+void prefixIndexRemove(PrefixIndex *index, int slot);
+void prefixIndexRemap(PrefixIndex *index, int from, int to);
+int completePrefix(PrefixIndex *index, Material *materials, const char *prefix,
+                   int limit, int *slots);
+void lookupAsYouType(Warehouse *wh);
+void runBatch(Warehouse *wh, char *transID);
+bool runBatchCommand(Span line, Warehouse *wh, char *transID);
+
+void markMaterialDirty(SnapshotStore *store, int slot);
+void markAllMaterialsDirty(SnapshotStore *store);
+void markTransactionsDirty(SnapshotStore *store, int from);
+void publishSnapshot(SnapshotStore *store, Material *materials,
+                     int materialCount, Transaction *transactions,
+                     int transactionCount);
+Snapshot *acquireSnapshot(SnapshotStore *store);
+void releaseSnapshot(Snapshot *snap);
+Material *snapshotMaterial(Snapshot *snap, int i);
+Transaction *snapshotTransaction(Snapshot *snap, int i);
+
 void displayMaterialList(Material *materials, int materialCount);
-void printMaterialPage(Material *materials, int materialCount, int page,
-                       int pageSize);
+void displayMaterialSnapshot();
+void displayMaterialView(MaterialView *view, char *title);
+void printMaterialPage(MaterialView *view, int page, int pageSize);
 void showCurrentInfo(Material *materials, int idx);
 
-void createNewTransaction(Transaction **transactions, int *transactionCount,
-                          Material *materials, int materialCount,
-                          char *transID);
-void transferMaterial(Transaction **transactions, Material *materials,
-                      int *transactionCount, int materialCount, char *id,
-                      int type,
+void createNewTransaction(Warehouse *wh, char *transID);
+void transferMaterial(Warehouse *wh, char *id, int type,
                       char *transID); // type 1: import | type 2: export
 void displayTransactionByID(Transaction *transactions, int transactionCount);
-void findTransactionByID(Transaction *transactions, int transactionCount);
-Transaction generateTransferHistory(char *matID, char *transID, int type);
+void findTransactionByID();
+Transaction generateTransferHistory(Material *material, char *transID,
+                                    int type, int qty);
+void recordMovement(Material *material, int type, int qty, time_t now);
+double consumptionRate(const Material *material, time_t now);
+void reportDaysOfCover();
+int reserveTransIdBlock(char *transID, int n);
+void fillTransaction(Transaction *transaction, char *matID, char prefix,
+                     int number, int type, const char *date);
+int applyMovementFile(Warehouse *wh, const char *path, char *transID);
+void bulkApplyMovements(Warehouse *wh, char *transID);
+
+int growCapacity(int capacity, int needed);
+StagedRow *stagingArea(MappedCatalog *catalog, int rows);
+void commitStagedRows(MappedCatalog *catalog, Material *materials,
+                      StagedRow *rows, int count, int transactionCount);
+int replayStagedRows(CatalogHeader *header);
+Material *reserveMaterialSlot(MappedCatalog *catalog, Material *materials,
+                              int newCount);
+Transaction *reserveTransactionSlot(MappedCatalog *catalog,
+                                    Transaction *transactions, int newCount);
+int openCatalog(MappedCatalog *catalog, const char *path,
+                Material **materials, int *materialCount,
+                Transaction **transactions, int *transactionCount);
+void syncCatalogCounts(MappedCatalog *catalog, int materialCount,
+                       int transactionCount);
+void closeCatalog(MappedCatalog *catalog);
+void releaseTables(MappedCatalog *catalog, Material *materials,
+                   Transaction *transactions);
+void benchStartup(const char *path);
+
+int openWarehouse(const char *code, const char *catalogPath,
+                  bool seedTestData);
+Warehouse *findWarehouse(const char *code);
+void commitWarehouses();
+void releaseWarehouses();
+void nextTransIdAfterAll(char *transID);
+int moveStock(Warehouse *from, Warehouse *to, int src, int qty,
+              char *transID);
+void applyMoveSide(Warehouse *wh, MoveSide *side);
+int finishPendingMoves();
+void switchWarehouse();
+void transferBetweenWarehouses(char *transID);
+void displayTotalsAcrossWarehouses();
+
+void materialChanged(Warehouse *wh, int slot);
+void tableChanged(Warehouse *wh);
+void buildBitmapIndex(BitmapIndex *bx, Material *materials,
+                      int materialCount);
+int bitmapCount(const Bitmap *bm);
+int bitmapSelect(const Bitmap *bm, int k);
+void displayFilteredList(Warehouse *wh);
+void reportStatusCounts();
+
+int compileFilter(const char *text, FilterPlan *plan, char *error,
+                  size_t errorSize);
+int runFilter(const FilterPlan *plan, Warehouse *wh, int *slots);
+void queryMaterials(Warehouse *wh);
+
+void *heapAlloc(size_t size);
+void *heapRealloc(void *p, size_t size);
+void *poolAlloc(Pool *pool);
+void poolFree(Pool *pool, void *p);
+void poolDrain(Pool *pool);
+void drainPools();
+void *arenaAlloc(size_t size);
+void arenaReset();
+
+void fillJournalFormat(JournalFormat *format, const char *magic);
+void writeJournalSnapshot(long journalOffset);
+bool journalFormatMatches(const JournalFormat *format, const char *magic);
+int openJournal(const char *path);
+void journalCommit();
+void closeJournal();
+int runReplica(const char *path);
+
+void deleteMaterial(Warehouse *wh);
+int liveSlots(Material *materials, int materialCount, int *slots);
+void compactStep(Warehouse *wh, int budget);
+int countTombstones(Material *materials, int materialCount);
+void maybeStartCompaction(Warehouse *wh);
+void finishCompaction(Warehouse *wh);
+
+// points into the catalog header when a catalog is mapped
+static UnitDictionary defaultUnits = {5, {"pcs", "kg", "m", "l", "bottle"}};
+static UnitDictionary *units = &defaultUnits;
+
+static Warehouse warehouses[MAX_WAREHOUSES];
+static int warehouseCount = 0;
+static Warehouse *active = NULL; // shard the operator works in
+
+// held while publishing every shard, so cross-shard readers see whole moves
+static pthread_mutex_t publishLock = PTHREAD_MUTEX_INITIALIZER;
+
+static JobQueue jobQueue = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                            .wake = PTHREAD_COND_INITIALIZER};
+
+static FILE *journal = NULL; // primary side, NULL when not journaling
+static char journalSnapshotPath[256];
+static bool journalAnnounce = false; // warehouse list not written yet
+static bool batchOutput = false; // stdout carries only batch answers
+static int journaledUnits = 0;
+static long journalCommits = 0;
+static long journalSnapshotDue = -1; // offset to snapshot after the commit
+
+static Replica replica = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// main thread only: worker threads never allocate from it
+static max_align_t scratchMemory[ARENA_SIZE / sizeof(max_align_t)];
+static Arena scratch;
+
+// calls to heapAlloc/heapRealloc only; libc and stdio allocate on their own
+static long wrapperAllocations = 0;
+static Pool snapshotPool = {PTHREAD_MUTEX_INITIALIZER, NULL, sizeof(Snapshot)};
+static Pool materialPagePool = {PTHREAD_MUTEX_INITIALIZER, NULL,
+                                sizeof(MaterialPage)};
+static Pool transactionPagePool = {PTHREAD_MUTEX_INITIALIZER, NULL,
+                                   sizeof(TransactionPage)};
+
+static InputReader input;
 
 // ======= Log with color =======
+// In batch mode stdout only carries answers, so notices and errors go to
+// stderr, without colour.
 void logToConsole(char *type, char *log) {
-  if (strcmp(type, "error") == 0) {
+  if (batchOutput) {
+    fputs(log, stderr);
+  } else if (strcmp(type, "error") == 0) {
     printf(RED "%s" RESET, log);
   } else if (strcmp(type, "choosen") == 0) {
     printf(YELLOW "%s" RESET, log);
@@ -82,20 +608,40 @@ void logToConsole(char *type, char *log) {
   }
 }
 
+void logfToConsole(char *type, const char *format, ...) {
+  char log[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(log, sizeof(log), format, args);
+  va_end(args);
+  logToConsole(type, log);
+}
+
 // ======= MENU =======
 void displayMenu() {
   logToConsole(
       "border",
       "=============================================================\n");
+  printf(" Warehouse: %s\n", active->code);
   logToConsole("choosen", " 1. Add new material\n");
   logToConsole("choosen", " 2. Update material info\n");
   logToConsole("choosen", " 3. Update material status\n");
-  logToConsole("choosen", " 4. Find material by ID/Name\n");
+  logToConsole("choosen", " 4. Find material by ID/Name (all warehouses)\n");
   logToConsole("choosen", " 5. Display material list\n");
   logToConsole("choosen", " 6. Sort material list\n");
   logToConsole("choosen", " 7. Make a transfer\n");
   logToConsole("choosen", " 8. View transaction history\n");
   logToConsole("choosen", " 9. Clear screen\n");
+  logToConsole("choosen", "11. Reports\n");
+  logToConsole("choosen", "12. Apply movement file\n");
+  logToConsole("choosen", "13. Lookup as you type\n");
+  logToConsole("choosen", "14. Jobs\n");
+  logToConsole("choosen", "15. Switch warehouse\n");
+  logToConsole("choosen", "16. Transfer between warehouses\n");
+  logToConsole("choosen", "17. Material totals across warehouses\n");
+  logToConsole("choosen", "18. Delete material\n");
+  logToConsole("choosen", "19. Filtered material list\n");
+  logToConsole("choosen", "20. Query materials (filter expression)\n");
   logToConsole("choosen", "10. Exit\n");
   logToConsole(
       "border",
@@ -103,71 +649,138 @@ void displayMenu() {
 }
 
 // ======= MAIN =======
-int main() {
-  Material *materials = NULL;
-  Transaction *transaction = NULL;
-
+int main(int argc, char **argv) {
   char initTransID[20] = "T000";
+  char *catalogPath = NULL;
+  char *journalPath = NULL;
+  bool batchMode = false;
+
+  char *codes[MAX_WAREHOUSES];
+  char *catalogPaths[MAX_WAREHOUSES] = {NULL};
+  int requested = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--catalog") == 0 && i + 1 < argc) {
+      catalogPath = argv[++i];
+    } else if (strcmp(argv[i], "--warehouse") == 0 && i + 1 < argc &&
+               requested < MAX_WAREHOUSES) {
+      // CODE or CODE=catalog-file
+      char *spec = argv[++i];
+      char *eq = strchr(spec, '=');
+      if (eq != NULL) {
+        *eq = '\0';
+        catalogPaths[requested] = eq + 1;
+      }
+      codes[requested++] = spec;
+    } else if (strcmp(argv[i], "--batch") == 0) {
+      batchMode = true;
+    } else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+      journalPath = argv[++i];
+    } else if (strcmp(argv[i], "--replica") == 0 && i + 1 < argc) {
+      return runReplica(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-startup") == 0 && i + 1 < argc) {
+      benchStartup(argv[++i]);
+      return 0;
+    } else {
+      printf("Usage: %s [--catalog <file>] [--warehouse <code>[=<file>]]... "
+             "[--journal <file>] [--batch]\n"
+             "       %s --replica <journal-file>\n"
+             "       %s --bench-startup <new-file>\n",
+             argv[0], argv[0], argv[0]);
+      return 1;
+    }
+  }
 
-  int materialCount = 0;
-  int transactionCount = 0;
+  // before anything is opened: startup notices must not reach the answers
+  batchOutput = batchMode;
 
-#if USE_MATERIAL_TEST_DATA
-  initTestMaterialData(&materials, &materialCount);
-#endif
+  if (requested == 0) {
+    codes[requested++] = "WH1";
+  }
+  if (catalogPath != NULL && catalogPaths[0] == NULL) {
+    catalogPaths[0] = catalogPath;
+  }
 
-#if USE_TRANSACTION_TEST_DATA
-  initTestTransData(&transaction, &transactionCount);
-#endif
+  // test data goes to the first warehouse only
+  for (int w = 0; w < requested; w++) {
+    if (openWarehouse(codes[w], catalogPaths[w], w == 0) != 0) {
+      releaseWarehouses();
+      return 1;
+    }
+  }
+  active = &warehouses[0];
+  if (finishPendingMoves() != 0) {
+    releaseWarehouses();
+    return 1;
+  }
 
-  if (transactionCount > 0) {
-    char lastID[20];
-    strcpy(lastID, transaction[transactionCount - 1].transId);
+  if (journalPath != NULL && openJournal(journalPath) != 0) {
+    releaseWarehouses();
+    return 1;
+  }
 
-    int number = atoi(lastID + 1);
-    number++;
-    char prefix = lastID[0];
+  nextTransIdAfterAll(initTransID);
+  commitWarehouses();
+  for (int w = 0; w < warehouseCount; w++) {
+    if (warehouses[w].snapshots.current == NULL) {
+      logToConsole("error", "Cannot publish the first snapshot.\n");
+      closeJournal();
+      releaseWarehouses();
+      return 1;
+    }
+  }
 
-    sprintf(initTransID, "%c%03d", prefix, number);
+  if (batchMode) {
+    runBatch(active, initTransID);
+    commitWarehouses();
+    closeJournal();
+    releaseWarehouses();
+    return 0;
   }
 
   int choice;
   do {
+    Warehouse *wh = active;
+
     displayMenu();
     readInt(&choice, "Enter your choice: ", "Choice");
 
     switch (choice) {
     case 1: {
-      createNewMaterial(&materials, &materialCount);
+      createNewMaterial(wh);
       break;
     }
     case 2: {
-      updateMaterial(materials, materialCount);
+      updateMaterial(wh);
       break;
     }
     case 3: {
-      updateMaterialStatus(materials, materialCount);
+      updateMaterialStatus(wh);
       break;
     }
     case 4: {
-      findMaterialByIdOrName(materials, materialCount);
+      findMaterialByIdOrName();
       break;
     }
     case 5: {
-      displayMaterialList(materials, materialCount);
+      displayMaterialSnapshot();
       break;
     }
     case 6: {
-      sortMaterial(materials, materialCount);
+      // slots move under a running compaction, let it finish first
+      finishCompaction(wh);
+      sortMaterial(wh->materials, wh->materialCount);
+      // sorting moves materials to other slots
+      buildPrefixIndex(&wh->index, wh->materials, wh->materialCount);
+      tableChanged(wh);
       break;
     }
     case 7: {
-      createNewTransaction(&transaction, &transactionCount, materials,
-                           materialCount, initTransID);
+      createNewTransaction(wh, initTransID);
       break;
     }
     case 8: {
-      findTransactionByID(transaction, transactionCount);
+      findTransactionByID();
       break;
     }
     case 9: {
@@ -178,60 +791,219 @@ int main() {
       logToConsole("announce", "Exiting program...\n");
       break;
     }
+    case 11: {
+      displayReportMenu();
+      break;
+    }
+    case 12: {
+      bulkApplyMovements(wh, initTransID);
+      break;
+    }
+    case 13: {
+      lookupAsYouType(wh);
+      break;
+    }
+    case 14: {
+      displayJobs();
+      break;
+    }
+    case 15: {
+      switchWarehouse();
+      break;
+    }
+    case 16: {
+      transferBetweenWarehouses(initTransID);
+      break;
+    }
+    case 17: {
+      displayTotalsAcrossWarehouses();
+      break;
+    }
+    case 18: {
+      deleteMaterial(wh);
+      break;
+    }
+    case 19: {
+      displayFilteredList(wh);
+      break;
+    }
+    case 20: {
+      queryMaterials(wh);
+      break;
+    }
     default: {
       logToConsole("error", "Invalid choice, please try again.\n\n");
       break;
     }
     }
+
+    for (int w = 0; w < warehouseCount; w++) {
+      compactStep(&warehouses[w], COMPACT_STEP_ROWS);
+    }
+    commitWarehouses();
+    arenaReset();
   } while (choice != 10);
 
-  free(materials);
-  free(transaction);
+  stopReportWorker();
+  closeJournal();
+  releaseWarehouses();
   return 0;
 }
 
 // ======= INPUT/OUTPUT helper =======
-void readValidLine(char *buffer, size_t size, char *announce, char *valueType) {
+// Next line of stdin. Returns 1 with the line in *line, 0 at end of input,
+// -1 for a line longer than the input block (its text is dropped).
+int readLine(Span *line) {
+  bool overlong = false;
+
   while (1) {
-    printf("%s", announce);
+    char *nl = memchr(input.buf + input.head, '\n', input.tail - input.head);
+    if (nl != NULL) {
+      *nl = '\0';
+      line->start = input.buf + input.head;
+      line->len = nl - line->start;
+      input.head = nl - input.buf + 1;
+      return overlong ? -1 : 1;
+    }
 
-    if (fgets(buffer, size, stdin) == NULL) {
-      logToConsole("error", "Error reading input.\n");
+    if (input.eof) {
+      if (input.head == input.tail) {
+        return overlong ? -1 : 0;
+      }
+      // last line without a newline, there is always room for the NUL
+      input.buf[input.tail] = '\0';
+      line->start = input.buf + input.head;
+      line->len = input.tail - input.head;
+      input.head = input.tail;
+      return overlong ? -1 : 1;
+    }
+
+    // keep the partial line, it moves to the front of the block
+    if (input.head > 0) {
+      memmove(input.buf, input.buf + input.head, input.tail - input.head);
+      input.tail -= input.head;
+      input.head = 0;
+    }
+    if (input.tail == sizeof(input.buf) - 1) {
+      overlong = true;
+      input.tail = 0;
+    }
+
+    // about to block: prompts have to be out first
+    fflush(stdout);
+    ssize_t n = read(STDIN_FILENO, input.buf + input.tail,
+                     sizeof(input.buf) - 1 - input.tail);
+    if (n < 0 && errno == EINTR) {
       continue;
     }
+    if (n <= 0) {
+      input.eof = true;
+    } else {
+      input.tail += n;
+    }
+  }
+}
 
-    size_t len = strlen(buffer);
+// split the next blank-separated field off the front of rest
+bool nextField(Span *rest, Span *field) {
+  char *p = rest->start;
+  char *end = rest->start + rest->len;
+  while (p < end && isspace((unsigned char)*p)) {
+    p++;
+  }
+  if (p == end) {
+    return false;
+  }
 
-    // buffer does not contain '\n'
-    // this mean user maybe type more than (size - 1) characters.
-    if (len > 0 && buffer[len - 1] != '\n') {
-      int ch;
-      int tooLong = 0;
+  field->start = p;
+  while (p < end && !isspace((unsigned char)*p)) {
+    p++;
+  }
+  field->len = p - field->start;
+  rest->len = end - p;
+  rest->start = p;
+  return true;
+}
 
-      // flush the remaining characters in stdin
-      // if we see anything before '\n', the input was actually too long.
-      while ((ch = getchar()) != '\n' && ch != EOF) {
-        tooLong = 1;
-      }
+bool spanIs(Span span, const char *text) {
+  return strlen(text) == span.len && memcmp(span.start, text, span.len) == 0;
+}
 
-      if (tooLong) {
-        printf(
-            RED
-            "%s is too long (max %zu characters). Please type again.\n" RESET,
-            valueType, size - 1);
-        continue; // ask user to re-enter
-      }
-      // if 'tooLong' is 0 user type exactly (size - 1) chars + Enter
-      // valid : continue processing normally
+// span without leading and trailing blanks
+Span trimSpan(Span span) {
+  while (span.len > 0 && isspace((unsigned char)*span.start)) {
+    span.start++;
+    span.len--;
+  }
+  while (span.len > 0 && isspace((unsigned char)span.start[span.len - 1])) {
+    span.len--;
+  }
+  return span;
+}
+
+// an int with optional blanks around it, what sscanf "%d %c" accepted
+bool parseInt(Span text, int *value) {
+  const char *p = text.start;
+  const char *end = text.start + text.len;
+  while (p < end && isspace((unsigned char)*p)) {
+    p++;
+  }
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  if (p == end || *p < '0' || *p > '9') {
+    return false;
+  }
+
+  long long result = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    result = result * 10 + (*p - '0');
+    if (result > 2147483648LL) {
+      return false;
+    }
+    p++;
+  }
+  while (p < end && isspace((unsigned char)*p)) {
+    p++;
+  }
+  if (p != end) {
+    return false;
+  }
+
+  result = negative ? -result : result;
+  if (result > 2147483647LL) {
+    return false;
+  }
+  *value = (int)result;
+  return true;
+}
+
+void readValidLine(char *buffer, size_t size, char *announce, char *valueType) {
+  while (1) {
+    printf("%s", announce);
+
+    Span line;
+    int got = readLine(&line);
+    if (got == 0) {
+      logToConsole("error", "Error reading input.\n");
+      continue;
     }
 
-    // Remove '\n' if it exists
-    buffer[strcspn(buffer, "\n")] = '\0';
+    if (got < 0 || line.len > size - 1) {
+      printf(
+          RED
+          "%s is too long (max %zu characters). Please type again.\n" RESET,
+          valueType, size - 1);
+      continue; // ask user to re-enter
+    }
 
     // check if the input is empty or only space
     int isEmpty = 1;
-    for (int i = 0; buffer[i] != '\0'; i++) {
-      if (!isspace((unsigned char)buffer[i])) {
+    for (size_t i = 0; i < line.len; i++) {
+      if (!isspace((unsigned char)line.start[i])) {
         isEmpty = 0;
         break;
       }
@@ -242,30 +1014,29 @@ void readValidLine(char *buffer, size_t size, char *announce, char *valueType) {
       continue;
     }
 
+    memcpy(buffer, line.start, line.len);
+    buffer[line.len] = '\0';
     return;
   }
 }
 
 void readInt(int *number, char *announce, char *valueType) {
   while (1) {
-    char input[1000];
-    char extra; // to check char after number
-
     printf("%s", announce);
 
-    if (fgets(input, sizeof(input), stdin) == NULL) {
+    Span line;
+    int got = readLine(&line);
+    if (got == 0) {
       printf(RED "Error reading %s, please try again.\n" RESET, valueType);
       continue;
     }
 
-    input[strcspn(input, "\n")] = '\0';
-
-    if (strlen(input) == 0) {
+    if (got > 0 && line.len == 0) {
       printf(RED "%s cannot be empty, please type again.\n" RESET, valueType);
       continue;
     }
 
-    if (sscanf(input, "%d %c", number, &extra) != 1) {
+    if (got < 0 || !parseInt(line, number)) {
       printf(RED "Invalid %s, please type again.\n" RESET, valueType);
       continue;
     }
@@ -281,33 +1052,36 @@ void readInt(int *number, char *announce, char *valueType) {
 }
 
 // ======= Material management helper =======
-void createNewMaterial(Material **materials, int *materialCount) {
-  if (*materialCount >= MAX_LIST_SIZE) {
+void createNewMaterial(Warehouse *wh) {
+  if (wh->materialCount >= MAX_LIST_SIZE) {
     printf(RED "Material list reached max size (%d). Cannot add more.\n" RESET,
            MAX_LIST_SIZE);
     return;
   }
 
-  int idxMaterial = *materialCount;
-  (*materialCount)++;
+  int idxMaterial = wh->materialCount;
+  wh->materialCount++;
 
   // reallocate
-  Material *temp = realloc(*materials, *materialCount * sizeof(Material));
+  Material *temp =
+      reserveMaterialSlot(&wh->catalog, wh->materials, wh->materialCount);
   if (temp == NULL) {
     logToConsole("error", "Allocate failed\n");
-    (*materialCount)--;
+    wh->materialCount--;
     return;
   }
-  *materials = temp;
+  wh->materials = temp;
+  Material *material = &wh->materials[idxMaterial];
+  // the slot may hold stale bytes from realloc or a compacted row
+  *material = (Material){0};
 
   // get material id (must be unique)
   do {
-    readValidLine((*materials + idxMaterial)->matId,
-                  sizeof((*materials + idxMaterial)->matId),
+    readValidLine(material->matId, sizeof(material->matId),
                   "Enter id of material: ", "ID");
 
-    if (findMaterialIndexById(*materials, (*materials + idxMaterial)->matId,
-                              idxMaterial) != -1) {
+    if (findMaterialIndexById(wh->materials, material->matId, idxMaterial) !=
+        -1) {
       logToConsole("error", "\nID must not duplicate existing material ID, "
                             "please try again!\n");
     } else {
@@ -316,29 +1090,30 @@ void createNewMaterial(Material **materials, int *materialCount) {
   } while (1);
 
   // get material name
-  readValidLine((*materials + idxMaterial)->name,
-                sizeof((*materials + idxMaterial)->name),
+  readValidLine(material->name, sizeof(material->name),
                 "Enter name of material: ", "Name");
 
   // get materials inventory quantity
-  readInt(&(*materials + idxMaterial)->qty,
+  readInt(&material->qty,
           "Enter inventory quantity ( must be greater than 0 ): ", "quantity");
 
   // get material unit
-  readValidLine((*materials + idxMaterial)->unit,
-                sizeof((*materials + idxMaterial)->unit),
-                "Enter unit of materials: ", "Unit");
+  material->unitCode = readUnit("Enter unit of materials: ");
 
   // default status 1 is active
-  (*materials + idxMaterial)->status = readStatusWithDefault();
+  material->status = readStatusWithDefault();
+
+  prefixIndexInsert(&wh->index, wh->materials, idxMaterial);
+  materialChanged(wh, idxMaterial);
 
   logToConsole("announce", "\nAdd new material successfully\n\n");
 }
 
 // ======= Create new transaction =======
-void createNewTransaction(Transaction **transactions, int *transactionCount,
-                          Material *materials, int materialCount,
-                          char *transID) {
+void createNewTransaction(Warehouse *wh, char *transID) {
+  Material *materials = wh->materials;
+  int materialCount = wh->materialCount;
+
   int mode;
   char id[10];
 
@@ -381,39 +1156,39 @@ void createNewTransaction(Transaction **transactions, int *transactionCount,
         continue; // enter other id
       }
 
-      transferMaterial(transactions, materials, transactionCount, materialCount,
-                       id, mode, transID);
+      transferMaterial(wh, id, mode, transID);
       break;
     }
   }
 }
 
 // ======= Transfer material =======
-void transferMaterial(Transaction **transactions, Material *materials,
-                      int *transactionCount, int materialCount, char *id,
-                      int type, char *transId) {
-  if (*transactionCount >= MAX_TRANS_SIZE) {
+void transferMaterial(Warehouse *wh, char *id, int type, char *transId) {
+  Material *materials = wh->materials;
+  int materialCount = wh->materialCount;
+
+  if (wh->transactionCount >= MAX_TRANS_SIZE) {
     printf(RED "Transaction list reached max size (%d). Cannot add more!" RESET,
            MAX_LIST_SIZE);
     return;
   }
-  int idxTransaction = *transactionCount;
-  (*transactionCount)++;
+  int idxTransaction = wh->transactionCount;
+  wh->transactionCount++;
 
   // reacollate transaction list
-  Transaction *temp =
-      realloc(*transactions, *transactionCount * sizeof(Transaction));
+  Transaction *temp = reserveTransactionSlot(&wh->catalog, wh->transactions,
+                                             wh->transactionCount);
   if (temp == NULL) {
     logToConsole("error", "Allocate failed\n");
-    (*transactionCount)--;
+    wh->transactionCount--;
     return;
   }
-  *transactions = temp;
+  wh->transactions = temp;
 
   int transCount = 0;
 
   for (int i = 0; i < materialCount; i++) {
-    if (strcasecmp(materials[i].matId, id) == 0) {
+    if (!materials[i].deleted && strcasecmp(materials[i].matId, id) == 0) {
       if (type == 1) {
         showCurrentInfo(materials, i);
         // import
@@ -427,8 +1202,9 @@ void transferMaterial(Transaction **transactions, Material *materials,
           }
         } while (transCount <= 0);
         materials[i].qty += transCount;
-        (*transactions)[idxTransaction] =
-            generateTransferHistory(materials[i].matId, transId, type);
+        wh->transactions[idxTransaction] =
+            generateTransferHistory(&materials[i], transId, type, transCount);
+        materialChanged(wh, i);
         showCurrentInfo(materials, i);
       } else {
         // export
@@ -449,8 +1225,9 @@ void transferMaterial(Transaction **transactions, Material *materials,
             continue;
           } else {
             materials[i].qty -= transCount;
-            (*transactions)[idxTransaction] =
-                generateTransferHistory(materials[i].matId, transId, type);
+            wh->transactions[idxTransaction] = generateTransferHistory(
+                &materials[i], transId, type, transCount);
+            materialChanged(wh, i);
             showCurrentInfo(materials, i);
             break;
           }
@@ -461,152 +1238,731 @@ void transferMaterial(Transaction **transactions, Material *materials,
 }
 
 // ======= Generate transfer history ========
-Transaction generateTransferHistory(char *matID, char *transID, int type) {
+Transaction generateTransferHistory(Material *material, char *transID,
+                                    int type, int qty) {
   Transaction transactions;
 
-  char prefix = transID[0];
-  int number = atoi(transID + 1);
-  number++;
-  sprintf(transID, "%c%03d", prefix, number);
-  strcpy(transactions.transId, transID);
-
-  strcpy(transactions.matId, matID);
-  if (type == 1) {
-    strcpy(transactions.type, "IN");
-  } else {
-    strcpy(transactions.type, "OUT");
-  }
+  int number = reserveTransIdBlock(transID, 1);
 
   time_t now = time(NULL);
-  struct tm *t = localtime(&now);
+  struct tm t;
+  localtime_r(&now, &t); // localtime() re-reads TZ and allocates each call
 
   char dateStr[11];
-  strftime(dateStr, sizeof(dateStr), "%d/%m/%Y", t);
+  strftime(dateStr, sizeof(dateStr), "%d/%m/%Y", &t);
 
-  strcpy(transactions.date, dateStr);
+  fillTransaction(&transactions, material->matId, transID[0], number, type,
+                  dateStr);
+  recordMovement(material, type, qty, now);
 
   return transactions;
 }
 
-// ======= Update material via ID =======
-void updateMaterial(Material *materials, int materialCount) {
-  if (materialCount == 0) {
-    logToConsole("error", "Material list is empty. Nothing to update.\n\n");
-    return;
+// ======= Consumption forecast =======
+// Each material keeps OUT quantities as a sum decayed with time constant
+// CONSUMPTION_WINDOW_DAYS, valued at lastActivity. Dividing the sum, decayed
+// to now, by the window gives an exponentially weighted usage per day.
+// Both updates are O(1), so no history is rescanned.
+double decayTo(const Material *material, time_t now) {
+  if (material->lastActivity == 0 || now <= material->lastActivity) {
+    return material->usage;
   }
+  double days = (double)(now - material->lastActivity) / SECONDS_PER_DAY;
+  return material->usage * exp(-days / CONSUMPTION_WINDOW_DAYS);
+}
 
-  char id[10];
-  readValidLine(id, sizeof(id), "Enter material ID to update: ", "ID");
+void recordMovement(Material *material, int type, int qty, time_t now) {
+  double usage = decayTo(material, now);
+  if (type == 2) {
+    usage += qty;
+  }
+  material->usage = (float)usage;
+  material->lastActivity = now;
+}
 
-  int idx = findMaterialIndexById(materials, id, materialCount);
-  if (idx == -1) {
-    logToConsole("error", "Material with this ID was not found.\n\n");
-    return;
+// units consumed per day
+double consumptionRate(const Material *material, time_t now) {
+  return decayTo(material, now) / CONSUMPTION_WINDOW_DAYS;
+}
+
+typedef struct {
+  Material *material;
+  double rate;
+  double cover; // days until stockout, HUGE_VAL without usage
+} CoverRow;
+
+int compareCover(const void *a, const void *b) {
+  const CoverRow *x = a;
+  const CoverRow *y = b;
+  if (x->cover != y->cover) {
+    return x->cover < y->cover ? -1 : 1;
   }
+  return strcmp(x->material->matId, y->material->matId);
+}
 
-  // show current info
-  showCurrentInfo(materials, idx);
+// active materials, the ones that run out first on top
+void reportDaysOfCover() {
+  Snapshot *snap = acquireSnapshot(&active->snapshots);
+  time_t now = time(NULL);
 
-  readValidLine(materials[idx].name, sizeof(materials[idx].name),
-                "Enter new name: ", "Name");
-  readValidLine(materials[idx].unit, sizeof(materials[idx].unit),
-                "Enter new unit: ", "Unit");
-  readInt(&materials[idx].qty, "Enter new quantity: ", "quantity");
+  CoverRow rows[MAX_LIST_SIZE];
+  int count = 0;
+  for (int i = 0; i < snap->materialCount; i++) {
+    Material *m = snapshotMaterial(snap, i);
+    if (m->deleted || m->status != 1) {
+      continue;
+    }
+    double rate = consumptionRate(m, now);
+    rows[count].material = m;
+    rows[count].rate = rate;
+    rows[count].cover = rate > 0 ? m->qty / rate : HUGE_VAL;
+    count++;
+  }
+  qsort(rows, count, sizeof(CoverRow), compareCover);
+
+  logToConsole("border", "\nDAYS OF COVER (ACTIVE MATERIALS)\n");
+  printf("+------------+-----------------------------------+----------+-------"
+         "-----+------------+\n");
+  printf("|  Mat ID    | Name                              |   Qty    | "
+         "Usage/day  |  Cover     |\n");
+  printf("+------------+-----------------------------------+----------+-------"
+         "-----+------------+\n");
+  for (int i = 0; i < count; i++) {
+    Material *m = rows[i].material;
+    char cover[16];
+    if (rows[i].cover == HUGE_VAL) {
+      snprintf(cover, sizeof(cover), "no usage");
+    } else {
+      snprintf(cover, sizeof(cover), "%.1f days", rows[i].cover);
+    }
+    printf("| %-10s | %-33s | %8d | %10.2f | %-10s |\n", m->matId, m->name,
+           m->qty, rows[i].rate, cover);
+  }
+  printf("+------------+-----------------------------------+----------+-------"
+         "-----+------------+\n\n");
 
-  printf(BLUE "\nUpdate material with ID %s successfully.\n" RESET, id);
+  releaseSnapshot(snap);
+}
 
-  showCurrentInfo(materials, idx);
+// advance transID past n new IDs, returns the number of the first one
+int reserveTransIdBlock(char *transID, int n) {
+  char prefix = transID[0];
+  int first = atoi(transID + 1) + 1;
+  sprintf(transID, "%c%03d", prefix, first + n - 1);
+  return first;
 }
 
-// ==== UPDATE STATUS ====
-void updateMaterialStatus(Material *materials, int materialCount) {
-  if (materialCount == 0) {
-    logToConsole("error", "Material list is empty.\n\n");
-    return;
+void fillTransaction(Transaction *transaction, char *matID, char prefix,
+                     int number, int type, const char *date) {
+  sprintf(transaction->transId, "%c%03d", prefix, number);
+  strcpy(transaction->matId, matID);
+  if (type == 1) {
+    strcpy(transaction->type, "IN");
+  } else {
+    strcpy(transaction->type, "OUT");
   }
+  strcpy(transaction->date, date);
+}
 
-  char id[10];
-  readValidLine(id, sizeof(id), "Enter material ID to toggle status: ", "ID");
+// ======= Bulk movement file =======
+// Lines are "<matId> <IN|OUT> <qty>", blank lines and '#' comments skipped.
+// Every line is validated before anything changes: the batch is applied
+// as a whole or not at all.
 
-  int idx = findMaterialIndexById(materials, id, materialCount);
-  if (idx == -1) {
-    logToConsole("error", "Material with this ID was not found.\n\n");
-    return;
+// whole file into scratch memory, NUL-terminated; NULL if unreadable
+char *readFileToArena(const char *path, size_t *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
   }
 
-  materials[idx].status = !materials[idx].status;
-
-  printf(BLUE "Status toggled successfully! New status: %s\n" RESET,
-         (materials[idx].status ? "Active" : "Expired"));
+  struct stat st;
+  char *text = NULL;
+  if (fstat(fd, &st) == 0 && (text = arenaAlloc(st.st_size + 1)) != NULL) {
+    size_t got = 0;
+    while (got < (size_t)st.st_size) {
+      ssize_t n = read(fd, text + got, st.st_size - got);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      got += n;
+    }
+    text[got] = '\0';
+    *size = got;
+  }
+  close(fd);
+  return text;
 }
 
-// ===== read material status with validation =====
-int readStatusWithDefault() {
-  char line[20];
+int parseMovementFile(const char *path, Material *materials,
+                      int materialCount, Movement *movements, int maxMoves,
+                      int *moveCount) {
+  size_t size;
+  char *text = readFileToArena(path, &size);
+  if (text == NULL) {
+    logToConsole("error", "Cannot open movement file.\n");
+    return -1;
+  }
 
-  while (1) {
-    printf("Enter status (0 = expired, 1 = active, empty = default active): ");
+  int errors = 0;
+  int lineNo = 0;
+  char *next = text;
+  char *end = text + size;
+  *moveCount = 0;
+
+  while (next < end) {
+    // split the next line off in place
+    char *line = next;
+    char *nl = memchr(line, '\n', end - line);
+    if (nl != NULL) {
+      *nl = '\0';
+      next = nl + 1;
+    } else {
+      next = end;
+    }
+    lineNo++;
 
-    if (fgets(line, sizeof(line), stdin) == NULL) {
-      logToConsole("error", "Error reading input. Try again.\n");
+    char *p = line;
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    if (*p == '\0' || *p == '#') {
       continue;
     }
 
-    // remove '\n'
-    line[strcspn(line, "\n")] = '\0';
-
-    // empty -> default
-    if (strlen(line) == 0) {
-      return 1; // default Active
+    char id[10];
+    char type[5];
+    char amount[16];
+    char extra;
+    if (sscanf(p, "%9s %4s %15s %c", id, type, amount, &extra) != 3) {
+      logfToConsole("error", "Line %d: expected <matId> <IN|OUT> <qty>.\n",
+                    lineNo);
+      errors++;
+      continue;
     }
 
-    // check valid 0 or 1
-    if (strcmp(line, "0") == 0)
-      return 0;
-    if (strcmp(line, "1") == 0)
-      return 1;
+    int mode = 0;
+    if (strcasecmp(type, "IN") == 0) {
+      mode = 1;
+    } else if (strcasecmp(type, "OUT") == 0) {
+      mode = 2;
+    } else {
+      logfToConsole("error", "Line %d: type must be IN or OUT.\n", lineNo);
+      errors++;
+      continue;
+    }
 
-    // invalid input
-    logToConsole("error", "Status must be 0 or 1. Please type again.\n");
+    char *amountEnd;
+    errno = 0;
+    long qty = strtol(amount, &amountEnd, 10);
+    if (*amountEnd != '\0' || errno == ERANGE || qty > 2147483647L) {
+      logfToConsole("error", "Line %d: amount is not a valid number.\n",
+                    lineNo);
+      errors++;
+      continue;
+    }
+    if (qty <= 0) {
+      logfToConsole("error", "Line %d: amount must be greater than zero.\n",
+                    lineNo);
+      errors++;
+      continue;
+    }
+
+    int idx = findMaterialIndexById(materials, id, materialCount);
+    if (idx == -1) {
+      logfToConsole("error", "Line %d: material %s not found.\n", lineNo, id);
+      errors++;
+      continue;
+    }
+    if (materials[idx].status == 0) {
+      logfToConsole("error", "Line %d: material %s is locked/expired.\n",
+                    lineNo, id);
+      errors++;
+      continue;
+    }
+
+    if (*moveCount >= maxMoves) {
+      logfToConsole("error",
+                    "Line %d: transaction list would exceed max size (%d).\n",
+                    lineNo, MAX_TRANS_SIZE);
+      errors++;
+      break;
+    }
+
+    Movement *m = &movements[(*moveCount)++];
+    m->materialIdx = idx;
+    m->type = mode;
+    m->qty = (int)qty;
+    m->line = lineNo;
   }
+
+  return errors == 0 ? 0 : -1;
 }
 
-// ===== Find by ID or Name ====
-void findMaterialByIdOrName(Material *materials, int materialCount) {
-  if (materialCount == 0) {
+// returns number of movements applied, -1 if the batch was rejected
+int applyMovementFile(Warehouse *wh, const char *path, char *transID) {
+  Material *materials = wh->materials;
+  int materialCount = wh->materialCount;
+
+  int maxMoves = MAX_TRANS_SIZE - wh->transactionCount;
+  Movement *movements =
+      arenaAlloc((maxMoves > 0 ? maxMoves : 1) * sizeof(Movement));
+  if (movements == NULL) {
+    logToConsole("error", "Memory allocation failed.\n");
+    return -1;
+  }
+
+  int moveCount = 0;
+  if (parseMovementFile(path, materials, materialCount, movements, maxMoves,
+                        &moveCount) != 0) {
+    return -1;
+  }
+  if (moveCount == 0) {
+    return 0;
+  }
+
+  // group by material: stock only has to be non-negative after the batch
+  long delta[MAX_LIST_SIZE] = {0};
+  for (int i = 0; i < moveCount; i++) {
+    Movement *m = &movements[i];
+    delta[m->materialIdx] += (m->type == 1) ? m->qty : -(long)m->qty;
+  }
+
+  int errors = 0;
+  for (int i = 0; i < materialCount; i++) {
+    long result = materials[i].qty + delta[i];
+    if (result < 0 || result > 2147483647L) {
+      logfToConsole("error", "Material %s would end with %ld on hand.\n",
+                    materials[i].matId, result);
+      errors++;
+    }
+  }
+  if (errors > 0) {
+    return -1;
+  }
+
+  int newCount = wh->transactionCount + moveCount;
+  Transaction *temp =
+      reserveTransactionSlot(&wh->catalog, wh->transactions, newCount);
+  StagedRow *staged = stagingArea(&wh->catalog, materialCount);
+  if (temp == NULL || staged == NULL) {
+    logToConsole("error", "Allocate failed\n");
+    return -1;
+  }
+  wh->transactions = temp;
+
+  // one ID block and one date for the whole batch
+  int first = reserveTransIdBlock(transID, moveCount);
+
+  time_t now = time(NULL);
+  struct tm t;
+  localtime_r(&now, &t);
+  char dateStr[11];
+  strftime(dateStr, sizeof(dateStr), "%d/%m/%Y", &t);
+
+  // the new rows are built aside; the table is untouched until the commit
+  int stagedIdx[MAX_LIST_SIZE];
+  int stagedCount = 0;
+  for (int i = 0; i < materialCount; i++) {
+    stagedIdx[i] = -1;
+  }
+  for (int i = 0; i < moveCount; i++) {
+    Movement *m = &movements[i];
+    int s = stagedIdx[m->materialIdx];
+    if (s == -1) {
+      s = stagedIdx[m->materialIdx] = stagedCount++;
+      staged[s].slot = m->materialIdx;
+      staged[s].row = materials[m->materialIdx];
+      staged[s].row.qty += delta[m->materialIdx];
+    }
+    recordMovement(&staged[s].row, m->type, m->qty, now);
+    fillTransaction(&wh->transactions[wh->transactionCount + i],
+                    materials[m->materialIdx].matId, transID[0], first + i,
+                    m->type, dateStr);
+  }
+
+  commitStagedRows(&wh->catalog, materials, staged, stagedCount,
+                   newCount);
+  for (int i = 0; i < stagedCount; i++) {
+    materialChanged(wh, staged[i].slot);
+  }
+  wh->transactionCount = newCount;
+
+  return moveCount;
+}
+
+void bulkApplyMovements(Warehouse *wh, char *transID) {
+  if (wh->materialCount == 0) {
     logToConsole("error", "Material list is empty.\n\n");
     return;
   }
 
-  char target[50];
-  readValidLine(target, sizeof(target), "Enter ID or Name to find: ", "target");
+  char path[256];
+  readValidLine(path, sizeof(path), "Enter movement file path: ", "Path");
 
-  int idx = findMaterialByID(materials, materialCount, target);
-
-  if (idx != -1) {
-    showCurrentInfo(materials, idx);
+  int firstNumber = atoi(transID + 1) + 1;
+  int applied = applyMovementFile(wh, path, transID);
+  if (applied < 0) {
+    logToConsole("error", "Movement file rejected, nothing was applied.\n\n");
+  } else if (applied == 0) {
+    logToConsole("announce", "Movement file has no movements.\n\n");
   } else {
-    findMaterialByName(materials, materialCount, target);
+    printf(BLUE "Applied %d movements (%c%03d - %s).\n\n" RESET, applied,
+           transID[0], firstNumber, transID);
+  }
+}
+
+// ======= Update material via ID =======
+void updateMaterial(Warehouse *wh) {
+  Material *materials = wh->materials;
+  int materialCount = wh->materialCount;
+
+  if (materialCount == 0) {
+    logToConsole("error", "Material list is empty. Nothing to update.\n\n");
+    return;
+  }
+
+  char id[10];
+  readValidLine(id, sizeof(id), "Enter material ID to update: ", "ID");
+
+  int idx = findMaterialIndexById(materials, id, materialCount);
+  if (idx == -1) {
+    logToConsole("error", "Material with this ID was not found.\n\n");
+    return;
   }
+
+  // show current info
+  showCurrentInfo(materials, idx);
+
+  // re-indexed below under the new name
+  prefixIndexRemove(&wh->index, idx);
+
+  readValidLine(materials[idx].name, sizeof(materials[idx].name),
+                "Enter new name: ", "Name");
+  materials[idx].unitCode = readUnit("Enter new unit: ");
+  readInt(&materials[idx].qty, "Enter new quantity: ", "quantity");
+
+  prefixIndexInsert(&wh->index, materials, idx);
+  materialChanged(wh, idx);
+
+  printf(BLUE "\nUpdate material with ID %s successfully.\n" RESET, id);
+
+  showCurrentInfo(materials, idx);
 }
 
-// ===== Find material by id ===== ( absolute id )
-int findMaterialByID(Material *materials, int materialCount, char *target) {
+// ==== UPDATE STATUS ====
+void updateMaterialStatus(Warehouse *wh) {
+  Material *materials = wh->materials;
+  int materialCount = wh->materialCount;
+
   if (materialCount == 0) {
     logToConsole("error", "Material list is empty.\n\n");
-    return -1;
+    return;
   }
 
-  int idx = findMaterialIndexById(materials, target, materialCount);
+  char id[10];
+  readValidLine(id, sizeof(id), "Enter material ID to toggle status: ", "ID");
+
+  int idx = findMaterialIndexById(materials, id, materialCount);
   if (idx == -1) {
     logToConsole("error", "Material with this ID was not found.\n\n");
+    return;
+  }
+
+  materials[idx].status = !materials[idx].status;
+  materialChanged(wh, idx);
+
+  printf(BLUE "Status toggled successfully! New status: %s\n" RESET,
+         (materials[idx].status ? "Active" : "Expired"));
+}
+
+// ===== read material status with validation =====
+int readStatusWithDefault() {
+  while (1) {
+    printf("Enter status (0 = expired, 1 = active, empty = default active): ");
+
+    Span line;
+    int got = readLine(&line);
+    if (got == 0) {
+      logToConsole("error", "Error reading input. Try again.\n");
+      continue;
+    }
+
+    // empty -> default
+    if (got > 0 && line.len == 0) {
+      return 1; // default Active
+    }
+
+    // check valid 0 or 1
+    if (got > 0 && spanIs(line, "0"))
+      return 0;
+    if (got > 0 && spanIs(line, "1"))
+      return 1;
+
+    // invalid input
+    logToConsole("error", "Status must be 0 or 1. Please type again.\n");
+  }
+}
+
+// ======= Unit dictionary =======
+// the report worker reads names while the UI may add units: a name is
+// written before the count that makes it visible
+const char *unitName(int code) {
+  if (code < 0 || code >= __atomic_load_n(&units->count, __ATOMIC_ACQUIRE)) {
+    return "?";
+  }
+  return units->names[code];
+}
+
+int findUnitCode(const char *name) {
+  for (int i = 0; i < units->count; i++) {
+    if (strcasecmp(units->names[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// returns the code of name, adding it when missing (-1 if dictionary full)
+int internUnit(const char *name) {
+  int code = findUnitCode(name);
+  if (code != -1) {
+    return code;
+  }
+  if (units->count >= MAX_UNITS) {
     return -1;
   }
 
-  showCurrentInfo(materials, idx);
-  return idx;
+  code = units->count;
+  snprintf(units->names[code], sizeof(units->names[code]), "%s", name);
+  for (char *c = units->names[code]; *c != '\0'; c++) {
+    *c = tolower((unsigned char)*c);
+  }
+  __atomic_store_n(&units->count, code + 1, __ATOMIC_RELEASE);
+  return code;
+}
+
+// read a unit, new units must be confirmed so typos don't become units
+int readUnit(char *announce) {
+  char unit[10];
+
+  while (1) {
+    readValidLine(unit, sizeof(unit), announce, "Unit");
+
+    int valid = 1;
+    for (int i = 0; unit[i] != '\0'; i++) {
+      if (!isalnum((unsigned char)unit[i])) {
+        valid = 0;
+        break;
+      }
+    }
+    if (!valid) {
+      logToConsole("error", "Unit must contain only letters and digits.\n");
+      continue;
+    }
+
+    int code = findUnitCode(unit);
+    if (code != -1) {
+      return code;
+    }
+
+    if (units->count >= MAX_UNITS) {
+      printf(RED "Unit list is full (%d units). Please use an existing "
+                 "unit.\n" RESET,
+             MAX_UNITS);
+      continue;
+    }
+
+    char answer[5];
+    printf(YELLOW "Unit '%s' is not in the unit list.\n" RESET, unit);
+    readValidLine(answer, sizeof(answer), "Add it as a new unit? (y/n): ",
+                  "Answer");
+    if (answer[0] == 'y' || answer[0] == 'Y') {
+      return internUnit(unit);
+    }
+  }
+}
+
+// ======= Prefix index =======
+// Two sorted arrays of material slots (by ID and by name, case-folded).
+// Every material starting with a prefix sits in one contiguous run, found
+// with a binary search.
+int prefixKeyCompare(const char *key, const char *prefix, size_t len) {
+  return strncasecmp(key, prefix, len);
+}
+
+// first position whose key is >= prefix (only its first len chars compared)
+int prefixLowerBound(int *order, int count, Material *materials, int byName,
+                     const char *prefix, size_t len) {
+  int lo = 0;
+  int hi = count;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    Material *m = &materials[order[mid]];
+    if (prefixKeyCompare(byName ? m->name : m->matId, prefix, len) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+void insertSorted(int *order, int count, Material *materials, int byName,
+                  int slot) {
+  Material *m = &materials[slot];
+  const char *key = byName ? m->name : m->matId;
+  int pos = prefixLowerBound(order, count, materials, byName, key,
+                             strlen(key) + 1);
+  memmove(&order[pos + 1], &order[pos], (count - pos) * sizeof(int));
+  order[pos] = slot;
+}
+
+// false if slot is not in order
+bool removeSlot(int *order, int count, int slot) {
+  for (int i = 0; i < count; i++) {
+    if (order[i] == slot) {
+      memmove(&order[i], &order[i + 1], (count - i - 1) * sizeof(int));
+      return true;
+    }
+  }
+  return false;
+}
+
+void prefixIndexInsert(PrefixIndex *index, Material *materials, int slot) {
+  if (index->count >= MAX_LIST_SIZE) {
+    return;
+  }
+  insertSorted(index->byId, index->count, materials, 0, slot);
+  insertSorted(index->byName, index->count, materials, 1, slot);
+  index->count++;
+}
+
+// the slot is found by value, so its key may already have been edited
+void prefixIndexRemove(PrefixIndex *index, int slot) {
+  if (!removeSlot(index->byId, index->count, slot)) {
+    return;
+  }
+  removeSlot(index->byName, index->count, slot);
+  index->count--;
+}
+
+// the record moved but kept its keys, so its sorted position still holds
+void prefixIndexRemap(PrefixIndex *index, int from, int to) {
+  for (int i = 0; i < index->count; i++) {
+    if (index->byId[i] == from) {
+      index->byId[i] = to;
+    }
+    if (index->byName[i] == from) {
+      index->byName[i] = to;
+    }
+  }
+}
+
+void buildPrefixIndex(PrefixIndex *index, Material *materials,
+                      int materialCount) {
+  index->count = 0;
+  for (int i = 0; i < materialCount; i++) {
+    if (!materials[i].deleted) {
+      prefixIndexInsert(index, materials, i);
+    }
+  }
+}
+
+// fills slots with up to limit matches, ID matches before name matches
+int completePrefix(PrefixIndex *index, Material *materials, const char *prefix,
+                   int limit, int *slots) {
+  size_t len = strlen(prefix);
+  bool seen[MAX_LIST_SIZE] = {false};
+  int found = 0;
+
+  for (int byName = 0; byName <= 1 && found < limit; byName++) {
+    int *order = byName ? index->byName : index->byId;
+    int pos = prefixLowerBound(order, index->count, materials, byName, prefix,
+                               len);
+
+    for (; pos < index->count && found < limit; pos++) {
+      Material *m = &materials[order[pos]];
+      if (prefixKeyCompare(byName ? m->name : m->matId, prefix, len) != 0) {
+        break;
+      }
+      if (!seen[order[pos]]) {
+        seen[order[pos]] = true;
+        slots[found++] = order[pos];
+      }
+    }
+  }
+  return found;
+}
+
+void lookupAsYouType(Warehouse *wh) {
+  Material *materials = wh->materials;
+  int materialCount = wh->materialCount;
+
+  if (materialCount == 0) {
+    logToConsole("error", "Material list is empty.\n\n");
+    return;
+  }
+
+  char prefix[50];
+  int slots[COMPLETION_LIMIT];
+  Span line;
+
+  logToConsole("announce", "Type the start of an ID or name, or an empty "
+                           "line to go back.\n");
+  while (1) {
+    // read raw: an empty line means back, and digits are a prefix here
+    printf("> ");
+    int got = readLine(&line);
+    if (got == 0) {
+      break;
+    }
+    line = trimSpan(line);
+    if (got < 0 || line.len >= sizeof(prefix)) {
+      logToConsole("error", "Prefix is too long.\n");
+      continue;
+    }
+    if (line.len == 0) {
+      break;
+    }
+    snprintf(prefix, sizeof(prefix), "%.*s", (int)line.len, line.start);
+
+    int found = completePrefix(&wh->index, materials, prefix,
+                               COMPLETION_LIMIT, slots);
+    if (found == 0) {
+      logToConsole("error", "No material starts with this.\n");
+      continue;
+    }
+    for (int i = 0; i < found; i++) {
+      Material *m = &materials[slots[i]];
+      printf(" %d. %-10s %-33s %6d %s\n", i + 1, m->matId, m->name, m->qty,
+             unitName(m->unitCode));
+    }
+
+    // the pick has its own prompt, so it never shadows a prefix
+    while (1) {
+      printf("Open result (1-%d, empty = new search): ", found);
+      got = readLine(&line);
+      if (got == 0 || (got > 0 && (line = trimSpan(line)).len == 0)) {
+        break;
+      }
+      int pick;
+      if (got > 0 && parseInt(line, &pick) && pick >= 1 && pick <= found) {
+        showCurrentInfo(materials, slots[pick - 1]);
+      } else {
+        printf(RED "Result must be between 1 and %d.\n" RESET, found);
+      }
+    }
+    if (got == 0) {
+      break;
+    }
+  }
 }
 
+// ===== Find by ID or Name ====
 // char to lowercase
 // subtring checking
 int containsIgnoreCase(char *haystack, char *needle) {
@@ -630,43 +1986,12 @@ int containsIgnoreCase(char *haystack, char *needle) {
   return 0;
 }
 
-// ==== Find material by name (substring, case-insensitive) ====
-void findMaterialByName(Material *materials, int materialCount, char *target) {
-  if (materialCount == 0) {
-    logToConsole("error", "Material list is empty!");
-    return;
-  }
-  Material *m = malloc(materialCount * sizeof(Material));
-  if (m == NULL) {
-    logToConsole("error", "Memory allocation failed.\n");
-    return;
-  }
-
-  int count = 0;
-
-  logToConsole("border", "\nSearch results:\n");
-
-  for (int i = 0; i < materialCount; i++) {
-    if (containsIgnoreCase(materials[i].name, target)) {
-      m[count] = materials[i];
-      count++;
-    }
-  }
-
-  if (count > 0) {
-    displayMaterialList(m, count);
-  } else {
-    logToConsole("error", "No material matched this name.\n\n");
-  }
-  free(m);
-}
-
 // show current material info
 void showCurrentInfo(Material *materials, int idx) {
   logToConsole("border", "\nCurrent information:\n");
   printf("ID     : %s\n", materials[idx].matId);
   printf("Name   : %s\n", materials[idx].name);
-  printf("Unit   : %s\n", materials[idx].unit);
+  printf("Unit   : %s\n", unitName(materials[idx].unitCode));
   printf("Qty    : %d\n", materials[idx].qty);
   printf("Status : %s\n\n",
          (materials[idx].status == 1) ? "Active" : "Expired");
@@ -675,7 +2000,7 @@ void showCurrentInfo(Material *materials, int idx) {
 // find exist material id
 int findMaterialIndexById(Material *m, char *id, int count) {
   for (int i = 0; i < count; i++) {
-    if (strcmp(m[i].matId, id) == 0) {
+    if (!m[i].deleted && strcmp(m[i].matId, id) == 0) {
       return i;
     }
   }
@@ -683,15 +2008,20 @@ int findMaterialIndexById(Material *m, char *id, int count) {
 }
 
 // ===== Display material list =====
-void printMaterialPage(Material *materials, int materialCount, int page,
-                       int pageSize) {
+Material *arrayRowAt(void *source, int i) { return &((Material *)source)[i]; }
+
+Material *snapshotRowAt(void *source, int i) {
+  return snapshotMaterial(source, i);
+}
+
+void printMaterialPage(MaterialView *view, int page, int pageSize) {
   int start = page * pageSize;
   int end = start + pageSize;
 
-  if (start >= materialCount)
+  if (start >= view->count)
     return;
-  if (end > materialCount)
-    end = materialCount;
+  if (end > view->count)
+    end = view->count;
 
   printf("\n+------+------------+-----------------------------------+----------"
          "+------------+------------+\n");
@@ -701,36 +2031,58 @@ void printMaterialPage(Material *materials, int materialCount, int page,
          "-----------+------------+\n");
 
   for (int i = start; i < end; i++) {
-    char *result = (materials[i].status == 1) ? "Active" : "Expired";
-    printf("| %4d | %-10s | %-33s | %8d | %-10s | %-10s |\n", i + 1,
-           materials[i].matId, materials[i].name, materials[i].qty,
-           materials[i].unit, result);
+    Material *m = view->rowAt(view->source, view->slots ? view->slots[i] : i);
+    char *result = (m->status == 1) ? "Active" : "Expired";
+    printf("| %4d | %-10s | %-33s | %8d | %-10s | %-10s |\n", i + 1, m->matId,
+           m->name, m->qty, unitName(m->unitCode), result);
   }
 
   printf("+------+------------+-----------------------------------+----------+-"
          "-----------+------------+\n");
   printf("Page %d / %d\n\n", page + 1,
-         (materialCount + pageSize - 1) / pageSize);
+         (view->count + pageSize - 1) / pageSize);
 }
 
 void displayMaterialList(Material *materials, int materialCount) {
-  if (materialCount == 0) {
-    logToConsole("error", "\nMaterial list is empty.\n\n");
-    return;
-  }
+  int slots[MAX_LIST_SIZE];
+  int count = liveSlots(materials, materialCount, slots);
+  MaterialView view = {count, arrayRowAt, materials, slots};
+  displayMaterialView(&view, "MATERIAL LIST");
+}
 
-  int pageSize = 10; // 2, 3, 5
-  int totalPages = (materialCount + pageSize - 1) / pageSize;
+// page through one consistent version while writers carry on
+void displayMaterialSnapshot() {
+  Snapshot *snap = acquireSnapshot(&active->snapshots);
+  int slots[MAX_LIST_SIZE];
+  int count = 0;
+  for (int i = 0; i < snap->materialCount; i++) {
+    if (!snapshotMaterial(snap, i)->deleted) {
+      slots[count++] = i;
+    }
+  }
+  MaterialView view = {count, snapshotRowAt, snap, slots};
+  displayMaterialView(&view, "MATERIAL LIST");
+  releaseSnapshot(snap);
+}
+
+void displayMaterialView(MaterialView *view, char *title) {
+  if (view->count == 0) {
+    logToConsole("error", "\nMaterial list is empty.\n\n");
+    return;
+  }
+
+  int pageSize = 10; // 2, 3, 5
+  int totalPages = (view->count + pageSize - 1) / pageSize;
 
   int currentPage = 1;
 
   while (1) {
     system("clear");
 
-    logToConsole("border", "MATERIAL LIST\n");
-    printf("Total materials: %d\n", materialCount);
+    logToConsole("border", title);
+    printf("\nTotal materials: %d\n", view->count);
 
-    printMaterialPage(materials, materialCount, currentPage - 1, pageSize);
+    printMaterialPage(view, currentPage - 1, pageSize);
 
     printf("You are on page %d of %d.\n", currentPage, totalPages);
 
@@ -744,7 +2096,8 @@ void displayMaterialList(Material *materials, int materialCount) {
     if (pageToView < 0 || pageToView > totalPages) {
       printf(RED "Page must be between 1 and %d.\n" RESET, totalPages);
       printf("Press Enter to continue...");
-      getchar();
+      Span ignored;
+      readLine(&ignored);
       continue;
     }
 
@@ -810,7 +2163,8 @@ void displayTransactionByID(Transaction *transactions, int transactionCount) {
     if (pageToView < 0 || pageToView > totalPages) {
       printf(RED "Page must be between 1 and %d.\n" RESET, totalPages);
       printf("Press Enter to continue...");
-      getchar();
+      Span ignored;
+      readLine(&ignored);
       continue;
     }
 
@@ -881,9 +2235,13 @@ void sortMaterial(Material *materials, int materialCount) {
   } while (mode != 3);
 }
 
-void findTransactionByID(Transaction *transactions, int transactionCount) {
+void findTransactionByID() {
+  Snapshot *snap = acquireSnapshot(&active->snapshots);
+  int transactionCount = snap->transactionCount;
+
   if (transactionCount == 0) {
     logToConsole("error", "\nTransaction list is empty.\n\n");
+    releaseSnapshot(snap);
     return;
   }
 
@@ -892,64 +2250,70 @@ void findTransactionByID(Transaction *transactions, int transactionCount) {
       matId, sizeof(matId),
       "Enter material ID to find transaction history: ", "Material ID");
 
-  Transaction *trans = malloc(transactionCount * sizeof(Transaction));
+  Transaction *trans = arenaAlloc(transactionCount * sizeof(Transaction));
   if (trans == NULL) {
     logToConsole("error", "Memory allocation failed.\n");
+    releaseSnapshot(snap);
     return;
   }
 
   int count = 0;
 
   for (int i = 0; i < transactionCount; i++) {
-    if (strcasecmp(transactions[i].matId, matId) == 0) {
-      trans[count] = transactions[i];
+    Transaction *t = snapshotTransaction(snap, i);
+    if (strcasecmp(t->matId, matId) == 0) {
+      trans[count] = *t;
       count++;
     }
   }
+  releaseSnapshot(snap);
 
   if (count > 0) {
     displayTransactionByID(trans, count);
   } else {
     logToConsole("error", "No transaction found for this material ID.\n\n");
   }
-
-  free(trans);
 }
 
+// designated, so fields added to Material later start out zeroed
+#define TEST_MATERIAL(id, matName, quantity, unit, state)                     \
+  {.matId = id, .name = matName, .qty = quantity, .unitCode = unit,            \
+   .status = state}
+
 void initTestMaterialData(Material **materials, int *materialCount) {
   Material testData[] = {
-      {"M001", "Bolt 8mm", 120, "pcs", 1},
-      {"M002", "Bolt 10mm", 95, "pcs", 1},
-      {"M003", "Nut 8mm", 200, "pcs", 1},
-      {"M004", "Nut 10mm", 180, "pcs", 1},
-      {"M005", "Steel Plate A3", 50, "kg", 1},
-      {"M006", "Steel Plate A4", 30, "kg", 1},
-      {"M007", "Cable Type-C", 60, "pcs", 1},
-      {"M008", "Cable Type-A", 40, "pcs", 0},
-      {"M009", "Pipe 20mm", 75, "m", 1},
-      {"M010", "Pipe 30mm", 45, "m", 1},
-
-      {"M011", "Washer 8mm", 300, "pcs", 1},
-      {"M012", "Washer 10mm", 260, "pcs", 0},
-      {"M013", "Screw 3cm", 500, "pcs", 1},
-      {"M014", "Screw 5cm", 350, "pcs", 1},
-      {"M015", "Iron Bar 6mm", 80, "m", 1},
-      {"M016", "Iron Bar 8mm", 70, "m", 1},
-      {"M017", "Iron Bar 10mm", 65, "m", 0},
-      {"M018", "Paint Red", 20, "l", 1},
-      {"M019", "Paint Blue", 25, "l", 1},
-      {"M020", "Paint White", 15, "l", 0},
-
-      {"M021", "PVC Glue", 12, "bottle", 1},
-      {"M022", "Contact Glue", 7, "bottle", 1},
-      {"M023", "Bearing 608", 44, "pcs", 1},
+      TEST_MATERIAL("M001", "Bolt 8mm", 120, UNIT_PCS, 1),
+      TEST_MATERIAL("M002", "Bolt 10mm", 95, UNIT_PCS, 1),
+      TEST_MATERIAL("M003", "Nut 8mm", 200, UNIT_PCS, 1),
+      TEST_MATERIAL("M004", "Nut 10mm", 180, UNIT_PCS, 1),
+      TEST_MATERIAL("M005", "Steel Plate A3", 50, UNIT_KG, 1),
+      TEST_MATERIAL("M006", "Steel Plate A4", 30, UNIT_KG, 1),
+      TEST_MATERIAL("M007", "Cable Type-C", 60, UNIT_PCS, 1),
+      TEST_MATERIAL("M008", "Cable Type-A", 40, UNIT_PCS, 0),
+      TEST_MATERIAL("M009", "Pipe 20mm", 75, UNIT_M, 1),
+      TEST_MATERIAL("M010", "Pipe 30mm", 45, UNIT_M, 1),
+
+      TEST_MATERIAL("M011", "Washer 8mm", 300, UNIT_PCS, 1),
+      TEST_MATERIAL("M012", "Washer 10mm", 260, UNIT_PCS, 0),
+      TEST_MATERIAL("M013", "Screw 3cm", 500, UNIT_PCS, 1),
+      TEST_MATERIAL("M014", "Screw 5cm", 350, UNIT_PCS, 1),
+      TEST_MATERIAL("M015", "Iron Bar 6mm", 80, UNIT_M, 1),
+      TEST_MATERIAL("M016", "Iron Bar 8mm", 70, UNIT_M, 1),
+      TEST_MATERIAL("M017", "Iron Bar 10mm", 65, UNIT_M, 0),
+      TEST_MATERIAL("M018", "Paint Red", 20, UNIT_L, 1),
+      TEST_MATERIAL("M019", "Paint Blue", 25, UNIT_L, 1),
+      TEST_MATERIAL("M020", "Paint White", 15, UNIT_L, 0),
+
+      TEST_MATERIAL("M021", "PVC Glue", 12, UNIT_BOTTLE, 1),
+      TEST_MATERIAL("M022", "Contact Glue", 7, UNIT_BOTTLE, 1),
+      TEST_MATERIAL("M023", "Bearing 608", 44, UNIT_PCS, 1),
   };
 
   int testCount = sizeof(testData) / sizeof(testData[0]);
 
-  Material *tmp = malloc(testCount * sizeof(Material));
+  Material *tmp = heapAlloc(testCount * sizeof(Material));
   if (tmp == NULL) {
-    printf(RED "Allocate test data failed\n" RESET);
+    logToConsole("error", "Allocate test data failed\n");
     return;
   }
 
@@ -975,9 +2339,9 @@ void initTestTransData(Transaction **transactions, int *transCount) {
 
   int count = sizeof(testData) / sizeof(testData[0]);
 
-  Transaction *tmp = malloc(count * sizeof(Transaction));
+  Transaction *tmp = heapAlloc(count * sizeof(Transaction));
   if (tmp == NULL) {
-    printf(RED "Allocate transaction test data failed\n" RESET);
+    logToConsole("error", "Allocate transaction test data failed\n");
     return;
   }
 
@@ -986,3 +2350,3080 @@ void initTestTransData(Transaction **transactions, int *transCount) {
   *transactions = tmp;
   *transCount = count;
 }
+
+// ======= Memory-mapped catalog =======
+// Lookups and paging read the records straight out of the mapping, so only
+// the pages a command touches are faulted in or dirtied.
+size_t catalogFileSize() {
+  return sizeof(CatalogHeader) + MAX_LIST_SIZE * sizeof(Material) +
+         MAX_TRANS_SIZE * sizeof(Transaction);
+}
+
+Material *catalogMaterials(CatalogHeader *header) {
+  return (Material *)((char *)header + sizeof(CatalogHeader));
+}
+
+Transaction *catalogTransactions(CatalogHeader *header) {
+  return (Transaction *)((char *)catalogMaterials(header) +
+                         MAX_LIST_SIZE * sizeof(Material));
+}
+
+// heap tables double so appends do not realloc once per row
+int growCapacity(int capacity, int needed) {
+  int grown = capacity < 16 ? 16 : capacity * 2;
+  return grown < needed ? needed : grown;
+}
+
+// the mapping is already sized for the max list sizes, so only heap tables
+// need to grow
+Material *reserveMaterialSlot(MappedCatalog *catalog, Material *materials,
+                              int newCount) {
+  if (catalog->header != NULL) {
+    return newCount <= MAX_LIST_SIZE ? materials : NULL;
+  }
+  if (newCount <= catalog->materialCapacity) {
+    return materials;
+  }
+  int capacity = growCapacity(catalog->materialCapacity, newCount);
+  Material *grown = heapRealloc(materials, capacity * sizeof(Material));
+  if (grown != NULL) {
+    catalog->materialCapacity = capacity;
+  }
+  return grown;
+}
+
+Transaction *reserveTransactionSlot(MappedCatalog *catalog,
+                                    Transaction *transactions, int newCount) {
+  if (catalog->header != NULL) {
+    return newCount <= MAX_TRANS_SIZE ? transactions : NULL;
+  }
+  if (newCount <= catalog->transactionCapacity) {
+    return transactions;
+  }
+  int capacity = growCapacity(catalog->transactionCapacity, newCount);
+  Transaction *grown =
+      heapRealloc(transactions, capacity * sizeof(Transaction));
+  if (grown != NULL) {
+    catalog->transactionCapacity = capacity;
+  }
+  return grown;
+}
+
+// where a bulk apply builds its new rows: the header of a mapped catalog,
+// the arena for heap tables
+StagedRow *stagingArea(MappedCatalog *catalog, int rows) {
+  if (catalog->header != NULL) {
+    return catalog->header->staged;
+  }
+  return arenaAlloc((rows > 0 ? rows : 1) * sizeof(StagedRow));
+}
+
+// Publish staged rows together with the transaction count. Transactions
+// past the old count are already written but not visible yet.
+void commitStagedRows(MappedCatalog *catalog, Material *materials,
+                      StagedRow *rows, int count, int transactionCount) {
+  CatalogHeader *header = catalog->header;
+  if (header != NULL) {
+    header->stagedTransactionCount = transactionCount;
+    __atomic_store_n(&header->stagedCount, count, __ATOMIC_RELEASE);
+  }
+  for (int i = 0; i < count; i++) {
+    materials[rows[i].slot] = rows[i].row;
+  }
+  if (header != NULL) {
+    header->transactionCount = transactionCount;
+    __atomic_store_n(&header->stagedCount, 0, __ATOMIC_RELEASE);
+  }
+}
+
+// finish a bulk apply a crash cut short; -1 if the staged batch is bad
+int replayStagedRows(CatalogHeader *header) {
+  int count = header->stagedCount;
+  if (count == 0) {
+    return 0;
+  }
+  if (count < 0 || count > MAX_LIST_SIZE ||
+      header->stagedTransactionCount < header->transactionCount ||
+      header->stagedTransactionCount > MAX_TRANS_SIZE) {
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    StagedRow *r = &header->staged[i];
+    if (r->slot < 0 || r->slot >= header->materialCount ||
+        r->row.unitCode >= header->units.count) {
+      return -1;
+    }
+  }
+
+  Material *materials = catalogMaterials(header);
+  for (int i = 0; i < count; i++) {
+    materials[header->staged[i].slot] = header->staged[i].row;
+  }
+  header->transactionCount = header->stagedTransactionCount;
+  header->stagedCount = 0;
+  logToConsole("announce", "Finished an interrupted movement batch.\n");
+  return 0;
+}
+
+// write a fresh catalog file holding the given tables
+int createCatalogFile(const char *path, Material *materials, int materialCount,
+                      Transaction *transactions, int transactionCount) {
+  size_t size = catalogFileSize();
+
+  int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+
+  CatalogHeader *header =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED) {
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+
+  memcpy(header->magic, CATALOG_MAGIC, sizeof(header->magic));
+  header->version = CATALOG_VERSION;
+  header->materialSize = sizeof(Material);
+  header->transactionSize = sizeof(Transaction);
+  header->materialCapacity = MAX_LIST_SIZE;
+  header->transactionCapacity = MAX_TRANS_SIZE;
+  header->materialCount = materialCount;
+  header->transactionCount = transactionCount;
+  header->units = *units;
+
+  if (materialCount > 0) {
+    memcpy(catalogMaterials(header), materials,
+           materialCount * sizeof(Material));
+  }
+  if (transactionCount > 0) {
+    memcpy(catalogTransactions(header), transactions,
+           transactionCount * sizeof(Transaction));
+  }
+
+  int ok = msync(header, size, MS_SYNC) == 0;
+  munmap(header, size);
+  close(fd);
+  return ok ? 0 : -1;
+}
+
+// map an existing catalog file and check it matches this build's layout
+int mapCatalogFile(const char *path, MappedCatalog *out) {
+  size_t size = catalogFileSize();
+
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    logToConsole("error", "Cannot open catalog file.\n");
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < size) {
+    logToConsole("error", "Catalog file is truncated.\n");
+    close(fd);
+    return -1;
+  }
+
+  CatalogHeader *header =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED) {
+    logToConsole("error", "Cannot map catalog file.\n");
+    close(fd);
+    return -1;
+  }
+
+  if (memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != CATALOG_VERSION ||
+      header->materialSize != (int)sizeof(Material) ||
+      header->transactionSize != (int)sizeof(Transaction) ||
+      header->materialCapacity != MAX_LIST_SIZE ||
+      header->transactionCapacity != MAX_TRANS_SIZE ||
+      header->materialCount < 0 || header->materialCount > MAX_LIST_SIZE ||
+      header->transactionCount < 0 ||
+      header->transactionCount > MAX_TRANS_SIZE ||
+      header->units.count < 0 || header->units.count > MAX_UNITS) {
+    logToConsole("error", "Catalog file has an incompatible layout.\n");
+    munmap(header, size);
+    close(fd);
+    return -1;
+  }
+
+  if (replayStagedRows(header) != 0) {
+    logToConsole("error", "Catalog holds a damaged movement batch.\n");
+    munmap(header, size);
+    close(fd);
+    return -1;
+  }
+
+  // unit codes index per-unit arrays, so a bad one must never get in
+  Material *rows = catalogMaterials(header);
+  for (int i = 0; i < header->materialCount; i++) {
+    if (rows[i].unitCode >= header->units.count) {
+      logfToConsole("error", "Catalog row %d has an unknown unit code %d.\n",
+                    i, rows[i].unitCode);
+      munmap(header, size);
+      close(fd);
+      return -1;
+    }
+  }
+
+  out->fd = fd;
+  out->size = size;
+  out->header = header;
+  return 0;
+}
+
+// Every mapped catalog carries a copy of the shared unit dictionary, the
+// first one opened holds the live copy.
+int mergeUnitDictionary(UnitDictionary *other) {
+  int common = other->count < units->count ? other->count : units->count;
+  for (int i = 0; i < common; i++) {
+    if (strcasecmp(other->names[i], units->names[i]) != 0) {
+      return -1;
+    }
+  }
+  for (int i = common; i < other->count; i++) {
+    if (internUnit(other->names[i]) != i) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int openCatalog(MappedCatalog *catalog, const char *path,
+                Material **materials, int *materialCount,
+                Transaction **transactions, int *transactionCount) {
+  if (access(path, F_OK) != 0) {
+    if (createCatalogFile(path, *materials, *materialCount, *transactions,
+                          *transactionCount) != 0) {
+      logToConsole("error", "Cannot create catalog file.\n");
+      return -1;
+    }
+    logfToConsole("announce", "Created catalog %s\n", path);
+  }
+
+  if (mapCatalogFile(path, catalog) != 0) {
+    return -1;
+  }
+
+  if (mergeUnitDictionary(&catalog->header->units) != 0) {
+    logToConsole("error",
+                 "Catalog unit list conflicts with another warehouse.\n");
+    munmap(catalog->header, catalog->size);
+    close(catalog->fd);
+    catalog->header = NULL;
+    return -1;
+  }
+  catalog->header->units = *units;
+  if (units == &defaultUnits) {
+    units = &catalog->header->units;
+  }
+
+  // the heap tables are replaced by the mapped ones
+  free(*materials);
+  free(*transactions);
+
+  *materials = catalogMaterials(catalog->header);
+  *transactions = catalogTransactions(catalog->header);
+  *materialCount = catalog->header->materialCount;
+  *transactionCount = catalog->header->transactionCount;
+  return 0;
+}
+
+// counts live in the header so a crash keeps every committed record
+void syncCatalogCounts(MappedCatalog *catalog, int materialCount,
+                       int transactionCount) {
+  CatalogHeader *header = catalog->header;
+  if (header == NULL) {
+    return;
+  }
+  if (header->materialCount != materialCount) {
+    header->materialCount = materialCount;
+  }
+  if (header->transactionCount != transactionCount) {
+    header->transactionCount = transactionCount;
+  }
+  if (&header->units != units && header->units.count != units->count) {
+    header->units = *units;
+  }
+}
+
+// free the heap tables, or unmap them when they live in the catalog
+void releaseTables(MappedCatalog *catalog, Material *materials,
+                   Transaction *transactions) {
+  if (catalog->header != NULL) {
+    closeCatalog(catalog);
+  } else {
+    free(materials);
+    free(transactions);
+    catalog->materialCapacity = 0;
+    catalog->transactionCapacity = 0;
+  }
+}
+
+void closeCatalog(MappedCatalog *catalog) {
+  if (catalog->header == NULL) {
+    return;
+  }
+  msync(catalog->header, catalog->size, MS_SYNC);
+  if (units == &catalog->header->units) {
+    defaultUnits = *units;
+    units = &defaultUnits;
+  }
+  munmap(catalog->header, catalog->size);
+  close(catalog->fd);
+  catalog->header = NULL;
+  catalog->fd = -1;
+}
+
+// ======= Startup benchmark =======
+// compares mapping the catalog against parsing a text export into the heap
+int writeCatalogText(const char *path, Material *materials, int materialCount,
+                     Transaction *transactions, int transactionCount) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < materialCount; i++) {
+    fprintf(f, "M|%s|%s|%d|%s|%d\n", materials[i].matId, materials[i].name,
+            materials[i].qty, unitName(materials[i].unitCode),
+            materials[i].status);
+  }
+  for (int i = 0; i < transactionCount; i++) {
+    fprintf(f, "T|%s|%s|%s|%s\n", transactions[i].transId,
+            transactions[i].matId, transactions[i].type, transactions[i].date);
+  }
+  return fclose(f);
+}
+
+int loadCatalogText(const char *path, Material **materials, int *materialCount,
+                    Transaction **transactions, int *transactionCount) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return -1;
+  }
+
+  Material *m = heapAlloc(MAX_LIST_SIZE * sizeof(Material));
+  Transaction *t = heapAlloc(MAX_TRANS_SIZE * sizeof(Transaction));
+  if (m == NULL || t == NULL) {
+    free(m);
+    free(t);
+    fclose(f);
+    return -1;
+  }
+
+  int mc = 0;
+  int tc = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (line[0] == 'M' && mc < MAX_LIST_SIZE) {
+      Material *r = &m[mc];
+      char unit[10];
+      if (sscanf(line, "M|%9[^|]|%49[^|]|%d|%9[^|]|%d", r->matId, r->name,
+                 &r->qty, unit, &r->status) == 5) {
+        int code = internUnit(unit);
+        if (code != -1) {
+          r->unitCode = code;
+          r->deleted = 0;
+          mc++;
+        }
+      }
+    } else if (line[0] == 'T' && tc < MAX_TRANS_SIZE) {
+      Transaction *r = &t[tc];
+      if (sscanf(line, "T|%19[^|]|%9[^|]|%4[^|]|%14[^|\n]", r->transId,
+                 r->matId, r->type, r->date) == 4) {
+        tc++;
+      }
+    }
+  }
+  fclose(f);
+
+  *materials = m;
+  *materialCount = mc;
+  *transactions = t;
+  *transactionCount = tc;
+  return 0;
+}
+
+double elapsedMicros(struct timespec start, struct timespec end) {
+  return (end.tv_sec - start.tv_sec) * 1e6 +
+         (end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+// ask the kernel to drop the file from the page cache (best effort)
+void evictFromPageCache(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+// The first publish copies every row into snapshot pages, so a mapped
+// startup still reads the whole table once. Publishing starts from empty
+// pools, as it does at real startup.
+void benchPublish(SnapshotStore *store, Material *materials,
+                  int materialCount, Transaction *transactions,
+                  int transactionCount) {
+  memset(store, 0, sizeof(SnapshotStore));
+  pthread_mutex_init(&store->lock, NULL);
+  store->transactionDirtyFrom = MAX_TRANS_SIZE;
+  publishSnapshot(store, materials, materialCount, transactions,
+                  transactionCount);
+}
+
+void benchUnpublish(SnapshotStore *store) {
+  releaseSnapshot(store->current);
+  pthread_mutex_destroy(&store->lock);
+  drainPools();
+}
+
+// one startup via the mapped catalog; the checksum keeps the reads live
+double timeMappedStartup(const char *path, bool publish, long *checksum) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  MappedCatalog mapped;
+  if (mapCatalogFile(path, &mapped) != 0) {
+    return -1;
+  }
+  Material *m = catalogMaterials(mapped.header);
+  int count = mapped.header->materialCount;
+  int idx = count > 0 ? findMaterialIndexById(m, m[count - 1].matId, count)
+                      : -1;
+  if (idx < 0) {
+    munmap(mapped.header, mapped.size);
+    close(mapped.fd);
+    return -1;
+  }
+  *checksum += m[idx].qty;
+  SnapshotStore store;
+  if (publish) {
+    benchPublish(&store, m, count, catalogTransactions(mapped.header),
+                 mapped.header->transactionCount);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (publish) {
+    benchUnpublish(&store);
+  }
+  munmap(mapped.header, mapped.size);
+  close(mapped.fd);
+  return elapsedMicros(start, end);
+}
+
+double timeParsedStartup(const char *path, bool publish, long *checksum) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  Material *m = NULL;
+  Transaction *t = NULL;
+  int mc = 0, tc = 0;
+  if (loadCatalogText(path, &m, &mc, &t, &tc) != 0) {
+    return -1;
+  }
+  int idx = mc > 0 ? findMaterialIndexById(m, m[mc - 1].matId, mc) : -1;
+  if (idx < 0) {
+    free(m);
+    free(t);
+    return -1;
+  }
+  *checksum += m[idx].qty;
+  SnapshotStore store;
+  if (publish) {
+    benchPublish(&store, m, mc, t, tc);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (publish) {
+    benchUnpublish(&store);
+  }
+  free(m);
+  free(t);
+  return elapsedMicros(start, end);
+}
+
+// Pad the seeded tables with generated rows up to the list sizes, so both
+// paths load a full catalog rather than a few cache lines of it.
+int fillBenchTables(Material **materials, int *materialCount,
+                    Transaction **transactions, int *transactionCount) {
+  Material *m = heapRealloc(*materials, MAX_LIST_SIZE * sizeof(Material));
+  if (m == NULL) {
+    return -1;
+  }
+  *materials = m;
+  Transaction *t =
+      heapRealloc(*transactions, MAX_TRANS_SIZE * sizeof(Transaction));
+  if (t == NULL) {
+    return -1;
+  }
+  *transactions = t;
+
+  for (int i = *materialCount; i < MAX_LIST_SIZE; i++) {
+    memset(&m[i], 0, sizeof(Material));
+    snprintf(m[i].matId, sizeof(m[i].matId), "M%03u",
+             (unsigned)(i + 1) % 1000);
+    snprintf(m[i].name, sizeof(m[i].name), "Bench item %d", i + 1);
+    m[i].qty = (i * 37) % 400;
+    m[i].unitCode = i % (UNIT_BOTTLE + 1);
+    m[i].status = i % 7 != 0;
+  }
+  *materialCount = MAX_LIST_SIZE;
+
+  for (int i = *transactionCount; i < MAX_TRANS_SIZE; i++) {
+    fillTransaction(&t[i], m[i % MAX_LIST_SIZE].matId, 'T', i + 1,
+                    i % 2 == 0 ? 1 : 2, "07/02/2025");
+  }
+  *transactionCount = MAX_TRANS_SIZE;
+  return 0;
+}
+
+int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+void benchStartup(const char *path) {
+  Material *materials = NULL;
+  Transaction *transactions = NULL;
+  int materialCount = 0;
+  int transactionCount = 0;
+
+  initTestMaterialData(&materials, &materialCount);
+  initTestTransData(&transactions, &transactionCount);
+  if (materialCount == 0 ||
+      fillBenchTables(&materials, &materialCount, &transactions,
+                      &transactionCount) != 0) {
+    logToConsole("error", "No material data to benchmark.\n");
+    free(materials);
+    free(transactions);
+    return;
+  }
+
+  char textPath[256];
+  snprintf(textPath, sizeof(textPath), "%s.txt", path);
+
+  // the benchmark writes its own files and must not replace a catalog
+  if (access(path, F_OK) == 0 || access(textPath, F_OK) == 0) {
+    printf(RED "%s or %s already exists; pick a new benchmark path.\n" RESET,
+           path, textPath);
+    free(materials);
+    free(transactions);
+    return;
+  }
+  if (createCatalogFile(path, materials, materialCount, transactions,
+                        transactionCount) != 0 ||
+      writeCatalogText(textPath, materials, materialCount, transactions,
+                       transactionCount) != 0) {
+    logToConsole("error", "Cannot write benchmark files.\n");
+    unlink(path);
+    unlink(textPath);
+    free(materials);
+    free(transactions);
+    return;
+  }
+  free(materials);
+  free(transactions);
+
+  int rounds = 1000;
+  long checksum = 0;
+
+  // rows: mmap, mmap + first publish, parse, parse + first publish. One
+  // cold start is mostly noise, so each row reports the median of several.
+  // The runs take turns and each round starts at another row, so neither a
+  // slow spell nor going first favours one of them.
+  const char *labels[] = {"mmap catalog", "mmap + publish", "parse and load",
+                          "parse + publish"};
+  enum { COLD_RUNS = 9 };
+  double coldRuns[4][COLD_RUNS];
+  double cold[4], warm[4] = {0};
+  for (int run = 0; run < COLD_RUNS; run++) {
+    for (int k = 0; k < 4; k++) {
+      int r = (run + k) % 4;
+      bool mappedRow = r < 2;
+      bool publish = r % 2 == 1;
+      const char *file = mappedRow ? path : textPath;
+      evictFromPageCache(file);
+      coldRuns[r][run] = mappedRow
+                             ? timeMappedStartup(file, publish, &checksum)
+                             : timeParsedStartup(file, publish, &checksum);
+      if (coldRuns[r][run] < 0) {
+        logToConsole("error", "Cannot read benchmark files back.\n");
+        unlink(path);
+        unlink(textPath);
+        return;
+      }
+    }
+  }
+  for (int r = 0; r < 4; r++) {
+    qsort(coldRuns[r], COLD_RUNS, sizeof(double), compareDoubles);
+    cold[r] = coldRuns[r][COLD_RUNS / 2];
+  }
+  for (int i = 0; i < rounds; i++) {
+    for (int r = 0; r < 4; r++) {
+      bool publish = r % 2 == 1;
+      warm[r] += r < 2 ? timeMappedStartup(path, publish, &checksum)
+                       : timeParsedStartup(textPath, publish, &checksum);
+    }
+  }
+
+  logToConsole("border", "STARTUP BENCHMARK\n");
+  printf("Records : %d materials, %d transactions\n", materialCount,
+         transactionCount);
+  printf("%-16s %12s %12s\n", "", "cold (us)", "warm (us)");
+  char coldNote[16];
+  snprintf(coldNote, sizeof(coldNote), "median of %d", COLD_RUNS);
+  printf("%-16s %12s %12s\n", "", coldNote, "mean");
+  for (int r = 0; r < 4; r++) {
+    printf("%-16s %12.1f %12.2f\n", labels[r], cold[r], warm[r] / rounds);
+  }
+  printf("(checksum %ld)\n", checksum);
+
+  unlink(path);
+  unlink(textPath);
+}
+
+// ======= Reports =======
+// status: 1 active | 0 expired | 2 all
+void aggregateByUnit(Snapshot *snap, int status, long *totalQty,
+                     int *materialTotal) {
+  memset(totalQty, 0, MAX_UNITS * sizeof(long));
+  memset(materialTotal, 0, MAX_UNITS * sizeof(int));
+
+  for (int start = 0; start < snap->materialCount;
+       start += SNAPSHOT_PAGE_ROWS) {
+    Material *rows = snap->materialPages[start / SNAPSHOT_PAGE_ROWS]->rows;
+    int n = snap->materialCount - start;
+    if (n > SNAPSHOT_PAGE_ROWS) {
+      n = SNAPSHOT_PAGE_ROWS;
+    }
+
+    for (int i = 0; i < n; i++) {
+      int match = ((status == 2) | (rows[i].status == status)) &
+                  !rows[i].deleted;
+      totalQty[rows[i].unitCode] += match * rows[i].qty;
+      materialTotal[rows[i].unitCode] += match;
+    }
+  }
+}
+
+int readStatusFilter() {
+  int status;
+  do {
+    readInt(&status, "Status filter (0 = expired, 1 = active, 2 = all): ",
+            "Status filter");
+    if (status > 2) {
+      logToConsole("error", "Status filter must be 0, 1 or 2.\n");
+    }
+  } while (status > 2);
+  return status;
+}
+
+void reportQuantityByUnit() {
+  int status = readStatusFilter();
+
+  long totalQty[MAX_UNITS];
+  int materialTotal[MAX_UNITS];
+  Snapshot *snap = acquireSnapshot(&active->snapshots);
+  aggregateByUnit(snap, status, totalQty, materialTotal);
+  releaseSnapshot(snap);
+
+  logToConsole("border", "\nQUANTITY BY UNIT\n");
+  printf("+------------+------------+--------------+\n");
+  printf("| Unit       | Materials  | Total qty    |\n");
+  printf("+------------+------------+--------------+\n");
+  for (int code = 0; code < units->count; code++) {
+    if (materialTotal[code] == 0) {
+      continue;
+    }
+    printf("| %-10s | %10d | %12ld |\n", unitName(code), materialTotal[code],
+           totalQty[code]);
+  }
+  printf("+------------+------------+--------------+\n\n");
+}
+
+void displayReportMenu() {
+  int mode;
+  do {
+    logToConsole("border", "===============\n");
+    logToConsole("choosen", "1. Quantity by unit\n");
+    logToConsole("choosen", "2. Inventory report to file (background)\n");
+    logToConsole("choosen", "3. Movement report to file (background)\n");
+    logToConsole("choosen", "4. Status and stock counts\n");
+    logToConsole("choosen", "5. Days of cover ranking\n");
+    logToConsole("choosen", "6. Back to main menu\n");
+    logToConsole("border", "===============\n");
+    readInt(&mode, "Enter report: ", "report");
+    switch (mode) {
+    case 1: {
+      reportQuantityByUnit();
+      break;
+    }
+    case 2: {
+      queueReport(REPORT_INVENTORY);
+      break;
+    }
+    case 3: {
+      queueReport(REPORT_MOVEMENT);
+      break;
+    }
+    case 4: {
+      reportStatusCounts();
+      break;
+    }
+    case 5: {
+      reportDaysOfCover();
+      break;
+    }
+    case 6: {
+      break;
+    }
+    default: {
+      logToConsole("error", "Invalid report, please type again.\n");
+      break;
+    }
+    }
+  } while (mode != 6);
+}
+
+// ======= Background report jobs =======
+// One worker thread drains the queue. Each job reads a single snapshot,
+// so the file is consistent even while the operator keeps editing.
+void setJobProgress(ReportJob *job, int done) {
+  pthread_mutex_lock(&jobQueue.lock);
+  job->done = done;
+  pthread_mutex_unlock(&jobQueue.lock);
+}
+
+int writeInventoryReport(FILE *f, Snapshot *snap, ReportJob *job) {
+  fprintf(f, "INVENTORY REPORT (version %ld)\n", snap->version);
+  fprintf(f, "%-10s | %-33s | %8s | %-10s | %-8s\n", "Mat ID", "Name", "Qty",
+          "Unit", "Status");
+
+  long totalQty = 0;
+  int live = 0;
+  for (int i = 0; i < snap->materialCount; i++) {
+    Material *m = snapshotMaterial(snap, i);
+    setJobProgress(job, i + 1);
+    if (m->deleted) {
+      continue;
+    }
+    live++;
+    fprintf(f, "%-10s | %-33s | %8d | %-10s | %-8s\n", m->matId, m->name,
+            m->qty, unitName(m->unitCode), m->status ? "Active" : "Expired");
+    totalQty += m->qty;
+  }
+
+  fprintf(f, "Materials: %d, total quantity: %ld\n", live, totalQty);
+  return ferror(f) ? -1 : 0;
+}
+
+int writeMovementReport(FILE *f, Snapshot *snap, ReportJob *job) {
+  fprintf(f, "MOVEMENT REPORT (version %ld)\n", snap->version);
+  fprintf(f, "%-10s | %-10s | %-10s | %-4s\n", "Trans ID", "Mat ID", "Date",
+          "Type");
+
+  int imports = 0;
+  for (int i = 0; i < snap->transactionCount; i++) {
+    Transaction *t = snapshotTransaction(snap, i);
+    fprintf(f, "%-10s | %-10s | %-10s | %-4s\n", t->transId, t->matId,
+            t->date, t->type);
+    imports += strcmp(t->type, "IN") == 0;
+    setJobProgress(job, i + 1);
+  }
+
+  fprintf(f, "Transactions: %d (IN %d, OUT %d)\n", snap->transactionCount,
+          imports, snap->transactionCount - imports);
+  return ferror(f) ? -1 : 0;
+}
+
+void runReportJob(ReportJob *job) {
+  Warehouse *wh = &warehouses[job->warehouse];
+  Snapshot *snap = job->snap;
+
+  pthread_mutex_lock(&jobQueue.lock);
+  job->total = job->kind == REPORT_INVENTORY ? snap->materialCount
+                                             : snap->transactionCount;
+  pthread_mutex_unlock(&jobQueue.lock);
+
+  int result = -1;
+  FILE *f = fopen(job->path, "w");
+  if (f != NULL) {
+    if (job->kind == REPORT_INVENTORY) {
+      fprintf(f, "Warehouse: %s\n", wh->code);
+      result = writeInventoryReport(f, snap, job);
+    } else {
+      fprintf(f, "Warehouse: %s\n", wh->code);
+      result = writeMovementReport(f, snap, job);
+    }
+    if (fclose(f) != 0) {
+      result = -1;
+    }
+  }
+  releaseSnapshot(snap);
+
+  pthread_mutex_lock(&jobQueue.lock);
+  job->snap = NULL;
+  job->state = result == 0 ? JOB_DONE : JOB_FAILED;
+  pthread_mutex_unlock(&jobQueue.lock);
+}
+
+// oldest queued job, NULL if none (caller holds the lock)
+ReportJob *nextQueuedJob() {
+  ReportJob *next = NULL;
+  for (int i = 0; i < MAX_JOBS; i++) {
+    ReportJob *job = &jobQueue.jobs[i];
+    if (job->id != 0 && job->state == JOB_QUEUED &&
+        (next == NULL || job->id < next->id)) {
+      next = job;
+    }
+  }
+  return next;
+}
+
+void *reportWorker(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&jobQueue.lock);
+  while (1) {
+    ReportJob *job = nextQueuedJob();
+    if (job == NULL) {
+      if (jobQueue.stopping) {
+        break;
+      }
+      pthread_cond_wait(&jobQueue.wake, &jobQueue.lock);
+      continue;
+    }
+
+    job->state = JOB_RUNNING;
+    pthread_mutex_unlock(&jobQueue.lock);
+    runReportJob(job);
+    pthread_mutex_lock(&jobQueue.lock);
+  }
+  pthread_mutex_unlock(&jobQueue.lock);
+  return NULL;
+}
+
+// returns the job id, -1 when every slot holds an unfinished job
+int submitReportJob(ReportKind kind, int warehouse, const char *path) {
+  // the last published version, so the report shows one committed state
+  // however many commands run before the worker gets to it
+  Snapshot *snap = acquireSnapshot(&warehouses[warehouse].snapshots);
+  if (snap == NULL) {
+    return -1;
+  }
+  pthread_mutex_lock(&jobQueue.lock);
+
+  if (!jobQueue.started) {
+    if (pthread_create(&jobQueue.worker, NULL, reportWorker, NULL) != 0) {
+      pthread_mutex_unlock(&jobQueue.lock);
+      releaseSnapshot(snap);
+      return -1;
+    }
+    jobQueue.started = true;
+  }
+
+  // reuse a free slot, else the oldest finished one
+  ReportJob *slot = NULL;
+  for (int i = 0; i < MAX_JOBS; i++) {
+    ReportJob *job = &jobQueue.jobs[i];
+    bool finished = job->state == JOB_DONE || job->state == JOB_FAILED;
+    if (job->id == 0) {
+      slot = job;
+      break;
+    }
+    if (finished && (slot == NULL || job->id < slot->id)) {
+      slot = job;
+    }
+  }
+  if (slot == NULL) {
+    pthread_mutex_unlock(&jobQueue.lock);
+    releaseSnapshot(snap);
+    return -1;
+  }
+
+  slot->id = ++jobQueue.nextId;
+  slot->kind = kind;
+  slot->warehouse = warehouse;
+  slot->state = JOB_QUEUED;
+  slot->done = 0;
+  slot->total = 0;
+  snprintf(slot->path, sizeof(slot->path), "%s", path);
+  slot->snap = snap;
+  int id = slot->id;
+
+  pthread_cond_signal(&jobQueue.wake);
+  pthread_mutex_unlock(&jobQueue.lock);
+  return id;
+}
+
+void queueReport(ReportKind kind) {
+  char path[256];
+  readValidLine(path, sizeof(path), "Enter report file path: ", "Path");
+
+  int id = submitReportJob(kind, active - warehouses, path);
+  if (id == -1) {
+    logToConsole("error", "Cannot queue the report, try again later.\n\n");
+    return;
+  }
+  printf(BLUE "Report queued as job %d. Check progress in Jobs.\n\n" RESET,
+         id);
+}
+
+void displayJobs() {
+  static const char *kinds[] = {"Inventory", "Movement"};
+  static const char *states[] = {"Queued", "Running", "Done", "Failed"};
+
+  // copy under the lock, print without it
+  ReportJob jobs[MAX_JOBS];
+  pthread_mutex_lock(&jobQueue.lock);
+  memcpy(jobs, jobQueue.jobs, sizeof(jobs));
+  int lastId = jobQueue.nextId;
+  pthread_mutex_unlock(&jobQueue.lock);
+
+  logToConsole("border", "\nREPORT JOBS\n");
+  printf("+------+------------+----------+-------------+---------------------"
+         "-+\n");
+  printf("| Job  | Report     | State    | Progress    | File                "
+         " |\n");
+  printf("+------+------------+----------+-------------+---------------------"
+         "-+\n");
+
+  int shown = 0;
+  for (int id = 1; id <= lastId; id++) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+      if (jobs[i].id != id) {
+        continue;
+      }
+      char progress[16];
+      snprintf(progress, sizeof(progress), "%d/%d", jobs[i].done,
+               jobs[i].total);
+      printf("| %4d | %-10s | %-8s | %11s | %-20.20s |\n", jobs[i].id,
+             kinds[jobs[i].kind], states[jobs[i].state], progress,
+             jobs[i].path);
+      shown++;
+    }
+  }
+  if (shown == 0) {
+    printf("| %-68s |\n", "No report jobs yet.");
+  }
+  printf("+------+------------+----------+-------------+---------------------"
+         "-+\n\n");
+}
+
+// let queued reports finish before the process exits
+void stopReportWorker() {
+  pthread_mutex_lock(&jobQueue.lock);
+  if (!jobQueue.started) {
+    pthread_mutex_unlock(&jobQueue.lock);
+    return;
+  }
+  if (nextQueuedJob() != NULL) {
+    logToConsole("announce", "Waiting for queued reports to finish...\n");
+  }
+  jobQueue.stopping = true;
+  pthread_cond_signal(&jobQueue.wake);
+  pthread_mutex_unlock(&jobQueue.lock);
+
+  pthread_join(jobQueue.worker, NULL);
+  jobQueue.started = false;
+}
+
+// ======= Batch mode =======
+// Reads one command per line from stdin and answers in plain text, for
+// scanners and scripts:
+//   complete [-n <limit>] <prefix>
+//                               IDs/names starting with prefix, which runs
+//                               to the end of the line
+//   show <matId>                one material
+//   filter <expression>         materials matching a filter expression
+//   apply <file>                bulk-apply a movement file
+//   stats                       scratch allocations, heap fallbacks, peak
+//                               bytes, resets and heapAlloc/heapRealloc
+//                               calls since start (not libc's own)
+//   quit
+void runBatch(Warehouse *wh, char *transID) {
+  Span line;
+  int got;
+
+  while ((got = readLine(&line)) != 0) {
+    if (got < 0) {
+      printf("error line too long\n");
+    } else if (!runBatchCommand(line, wh, transID)) {
+      break;
+    }
+    fflush(stdout);
+    for (int w = 0; w < warehouseCount; w++) {
+      compactStep(&warehouses[w], COMPACT_STEP_ROWS);
+    }
+    commitWarehouses();
+    arenaReset();
+  }
+}
+
+// answer one batch line; false once the client asked to quit. A NULL
+// transID makes the tables read-only (replica mode).
+bool runBatchCommand(Span line, Warehouse *wh, char *transID) {
+  Span rest = line;
+  Span command;
+  Span field;
+  if (!nextField(&rest, &command)) {
+    return true;
+  }
+  // the filter expression is everything after the command
+  char *expression = command.start + command.len;
+
+  char arg[256] = "";
+  int fields = 1;
+  if (nextField(&rest, &field)) {
+    snprintf(arg, sizeof(arg), "%.*s", (int)field.len, field.start);
+    fields++;
+  }
+
+  if (spanIs(command, "quit")) {
+    return false;
+  } else if (spanIs(command, "complete") && fields >= 2) {
+    Span prefix = {expression, line.start + line.len - expression};
+    Span option = prefix;
+    int limit = COMPLETION_LIMIT;
+    if (nextField(&option, &field) && spanIs(field, "-n")) {
+      if (!nextField(&option, &field) || !parseInt(field, &limit) ||
+          limit < 1 || limit > MAX_LIST_SIZE) {
+        printf("error bad limit\n");
+        return true;
+      }
+      prefix = option;
+    }
+    prefix = trimSpan(prefix);
+    if (prefix.len == 0) {
+      printf("error missing prefix\n");
+      return true;
+    }
+    snprintf(arg, sizeof(arg), "%.*s", (int)prefix.len, prefix.start);
+
+    int slots[MAX_LIST_SIZE];
+    int found = completePrefix(&wh->index, wh->materials, arg, limit, slots);
+    for (int i = 0; i < found; i++) {
+      printf("%s\t%s\n", wh->materials[slots[i]].matId,
+             wh->materials[slots[i]].name);
+    }
+    printf("ok %d\n", found);
+  } else if (spanIs(command, "show") && fields >= 2) {
+    int idx = findMaterialIndexById(wh->materials, arg, wh->materialCount);
+    if (idx == -1) {
+      printf("error not found\n");
+      return true;
+    }
+    Material *m = &wh->materials[idx];
+    printf("%s\t%s\t%d\t%s\t%s\n", m->matId, m->name, m->qty,
+           unitName(m->unitCode), m->status ? "Active" : "Expired");
+    printf("ok 1\n");
+  } else if (spanIs(command, "filter") && fields >= 2) {
+    FilterPlan plan;
+    char error[100];
+    if (compileFilter(expression, &plan, error, sizeof(error)) == -1) {
+      printf("error %s\n", error);
+      return true;
+    }
+    int slots[MAX_LIST_SIZE];
+    int found = runFilter(&plan, wh, slots);
+    for (int i = 0; i < found; i++) {
+      Material *m = &wh->materials[slots[i]];
+      printf("%s\t%s\t%d\t%s\t%s\n", m->matId, m->name, m->qty,
+             unitName(m->unitCode), m->status ? "Active" : "Expired");
+    }
+    printf("ok %d\n", found);
+  } else if (spanIs(command, "stats")) {
+    printf("%ld\t%ld\t%zu\t%ld\t%ld\n", scratch.allocations,
+           scratch.heapFallbacks, scratch.peak, scratch.resets,
+           __atomic_load_n(&wrapperAllocations, __ATOMIC_RELAXED));
+    printf("ok 1\n");
+  } else if (spanIs(command, "apply") && fields >= 2) {
+    if (transID == NULL) {
+      printf("error read-only replica\n");
+      return true;
+    }
+    int applied = applyMovementFile(wh, arg, transID);
+    if (applied < 0) {
+      printf("error rejected\n");
+    } else {
+      printf("ok %d\n", applied);
+    }
+  } else {
+    printf("error unknown command\n");
+  }
+  return true;
+}
+
+// ======= Snapshots =======
+// Writers mark what they touch and publish after each command; publishing
+// copies only dirty pages. Readers take a reference to the current
+// version, so they never see a half-done command and never block writers
+// for longer than the pointer swap. A version is freed by whoever drops
+// its last reference.
+//
+// Mapped catalogs are copied too: a page that pointed into the mapping
+// would change under its readers with the next write. The cost is one
+// full copy at the first publish.
+void markMaterialDirty(SnapshotStore *store, int slot) {
+  store->materialDirty[slot / SNAPSHOT_PAGE_ROWS] = true;
+}
+
+void markAllMaterialsDirty(SnapshotStore *store) {
+  for (int p = 0; p < MATERIAL_PAGES; p++) {
+    store->materialDirty[p] = true;
+  }
+}
+
+void markTransactionsDirty(SnapshotStore *store, int from) {
+  if (from < store->transactionDirtyFrom) {
+    store->transactionDirtyFrom = from;
+  }
+}
+
+int pagesFor(int rows) {
+  return (rows + SNAPSHOT_PAGE_ROWS - 1) / SNAPSHOT_PAGE_ROWS;
+}
+
+void dropMaterialPage(MaterialPage *page) {
+  if (page != NULL &&
+      __atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    poolFree(&materialPagePool, page);
+  }
+}
+
+void dropTransactionPage(TransactionPage *page) {
+  if (page != NULL &&
+      __atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    poolFree(&transactionPagePool, page);
+  }
+}
+
+void releaseSnapshot(Snapshot *snap) {
+  if (snap == NULL ||
+      __atomic_sub_fetch(&snap->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+    return;
+  }
+  for (int p = 0; p < MATERIAL_PAGES; p++) {
+    dropMaterialPage(snap->materialPages[p]);
+  }
+  for (int p = 0; p < TRANSACTION_PAGES; p++) {
+    dropTransactionPage(snap->transactionPages[p]);
+  }
+  poolFree(&snapshotPool, snap);
+}
+
+// NULL only before the first publish
+Snapshot *acquireSnapshot(SnapshotStore *store) {
+  pthread_mutex_lock(&store->lock);
+  Snapshot *snap = store->current;
+  if (snap != NULL) {
+    __atomic_add_fetch(&snap->refs, 1, __ATOMIC_ACQ_REL);
+  }
+  pthread_mutex_unlock(&store->lock);
+  return snap;
+}
+
+Material *snapshotMaterial(Snapshot *snap, int i) {
+  return &snap->materialPages[i / SNAPSHOT_PAGE_ROWS]
+              ->rows[i % SNAPSHOT_PAGE_ROWS];
+}
+
+Transaction *snapshotTransaction(Snapshot *snap, int i) {
+  return &snap->transactionPages[i / SNAPSHOT_PAGE_ROWS]
+              ->rows[i % SNAPSHOT_PAGE_ROWS];
+}
+
+// copy rows [p * SNAPSHOT_PAGE_ROWS, count) of page p out of the live table
+MaterialPage *copyMaterialPage(Material *materials, int count, int p) {
+  MaterialPage *page = poolAlloc(&materialPagePool);
+  if (page == NULL) {
+    return NULL;
+  }
+  int start = p * SNAPSHOT_PAGE_ROWS;
+  int n = count - start < SNAPSHOT_PAGE_ROWS ? count - start
+                                             : SNAPSHOT_PAGE_ROWS;
+  page->refs = 1;
+  memcpy(page->rows, &materials[start], n * sizeof(Material));
+  return page;
+}
+
+TransactionPage *copyTransactionPage(Transaction *transactions, int count,
+                                     int p) {
+  TransactionPage *page = poolAlloc(&transactionPagePool);
+  if (page == NULL) {
+    return NULL;
+  }
+  int start = p * SNAPSHOT_PAGE_ROWS;
+  int n = count - start < SNAPSHOT_PAGE_ROWS ? count - start
+                                             : SNAPSHOT_PAGE_ROWS;
+  page->refs = 1;
+  memcpy(page->rows, &transactions[start], n * sizeof(Transaction));
+  return page;
+}
+
+void publishSnapshot(SnapshotStore *store, Material *materials,
+                     int materialCount, Transaction *transactions,
+                     int transactionCount) {
+  Snapshot *old = store->current;
+  int oldMaterials = old != NULL ? old->materialCount : 0;
+  int oldTransactions = old != NULL ? old->transactionCount : 0;
+
+  // a count change dirties the page the old and new ends fall in
+  if (materialCount != oldMaterials) {
+    int from = materialCount < oldMaterials ? materialCount : oldMaterials;
+    for (int p = from / SNAPSHOT_PAGE_ROWS; p < MATERIAL_PAGES; p++) {
+      store->materialDirty[p] = true;
+    }
+  }
+  if (transactionCount != oldTransactions) {
+    markTransactionsDirty(store, transactionCount < oldTransactions
+                              ? transactionCount
+                              : oldTransactions);
+  }
+
+  bool dirty = old == NULL || store->transactionDirtyFrom < MAX_TRANS_SIZE;
+  for (int p = 0; p < MATERIAL_PAGES && !dirty; p++) {
+    dirty = store->materialDirty[p];
+  }
+  if (!dirty) {
+    return;
+  }
+
+  Snapshot *snap = poolAlloc(&snapshotPool);
+  if (snap == NULL) {
+    logToConsole("error", "Allocate snapshot failed\n");
+    return; // dirty marks stay for the next publish
+  }
+  memset(snap, 0, sizeof(Snapshot));
+  snap->refs = 1; // owned by the store
+  snap->version = old != NULL ? old->version + 1 : 1;
+  snap->materialCount = materialCount;
+  snap->transactionCount = transactionCount;
+
+  bool failed = false;
+  for (int p = 0; p < pagesFor(materialCount) && !failed; p++) {
+    if (old == NULL || store->materialDirty[p]) {
+      snap->materialPages[p] = copyMaterialPage(materials, materialCount, p);
+      failed = snap->materialPages[p] == NULL;
+    } else {
+      snap->materialPages[p] = old->materialPages[p];
+      __atomic_add_fetch(&snap->materialPages[p]->refs, 1, __ATOMIC_ACQ_REL);
+    }
+  }
+
+  int firstDirty = store->transactionDirtyFrom / SNAPSHOT_PAGE_ROWS;
+  for (int p = 0; p < pagesFor(transactionCount) && !failed; p++) {
+    if (old == NULL || p >= firstDirty) {
+      snap->transactionPages[p] =
+          copyTransactionPage(transactions, transactionCount, p);
+      failed = snap->transactionPages[p] == NULL;
+    } else {
+      snap->transactionPages[p] = old->transactionPages[p];
+      __atomic_add_fetch(&snap->transactionPages[p]->refs, 1,
+                         __ATOMIC_ACQ_REL);
+    }
+  }
+
+  if (failed) {
+    logToConsole("error", "Allocate snapshot failed\n");
+    releaseSnapshot(snap);
+    return;
+  }
+
+  pthread_mutex_lock(&store->lock);
+  store->current = snap;
+  pthread_mutex_unlock(&store->lock);
+
+  for (int p = 0; p < MATERIAL_PAGES; p++) {
+    store->materialDirty[p] = false;
+  }
+  store->transactionDirtyFrom = MAX_TRANS_SIZE;
+
+  // readers still holding the old version keep it alive
+  releaseSnapshot(old);
+}
+
+// ======= Warehouses =======
+int openWarehouse(const char *code, const char *catalogPath,
+                  bool seedTestData) {
+  if (warehouseCount >= MAX_WAREHOUSES) {
+    logfToConsole("error", "At most %d warehouses are supported.\n",
+                  MAX_WAREHOUSES);
+    return -1;
+  }
+  if (findWarehouse(code) != NULL) {
+    logfToConsole("error", "Warehouse %s is listed twice.\n", code);
+    return -1;
+  }
+
+  Warehouse *wh = &warehouses[warehouseCount];
+  memset(wh, 0, sizeof(Warehouse));
+  snprintf(wh->code, sizeof(wh->code), "%s", code);
+  wh->catalog.fd = -1;
+  pthread_mutex_init(&wh->snapshots.lock, NULL);
+  wh->snapshots.transactionDirtyFrom = MAX_TRANS_SIZE;
+
+#if USE_MATERIAL_TEST_DATA
+  if (seedTestData) {
+    initTestMaterialData(&wh->materials, &wh->materialCount);
+  }
+#endif
+
+#if USE_TRANSACTION_TEST_DATA
+  if (seedTestData) {
+    initTestTransData(&wh->transactions, &wh->transactionCount);
+  }
+#endif
+  (void)seedTestData;
+
+  // a new catalog file is seeded from the tables loaded above
+  if (catalogPath != NULL &&
+      openCatalog(&wh->catalog, catalogPath, &wh->materials,
+                  &wh->materialCount, &wh->transactions,
+                  &wh->transactionCount) != 0) {
+    free(wh->materials);
+    free(wh->transactions);
+    pthread_mutex_destroy(&wh->snapshots.lock);
+    return -1;
+  }
+
+  buildPrefixIndex(&wh->index, wh->materials, wh->materialCount);
+  buildBitmapIndex(&wh->bitmaps, wh->materials, wh->materialCount);
+  // a mapped catalog keeps the tombstones of earlier runs
+  wh->tombstones = countTombstones(wh->materials, wh->materialCount);
+  maybeStartCompaction(wh);
+  warehouseCount++;
+  return 0;
+}
+
+Warehouse *findWarehouse(const char *code) {
+  for (int w = 0; w < warehouseCount; w++) {
+    if (strcasecmp(warehouses[w].code, code) == 0) {
+      return &warehouses[w];
+    }
+  }
+  return NULL;
+}
+
+// persist counts and publish every shard as one step
+void commitWarehouses() {
+  pthread_mutex_lock(&publishLock);
+  for (int w = 0; w < warehouseCount; w++) {
+    Warehouse *wh = &warehouses[w];
+    syncCatalogCounts(&wh->catalog, wh->materialCount, wh->transactionCount);
+    publishSnapshot(&wh->snapshots, wh->materials, wh->materialCount,
+                    wh->transactions, wh->transactionCount);
+  }
+  journalCommit();
+  pthread_mutex_unlock(&publishLock);
+
+  // Only this thread writes the tables, so they still match the journal
+  // offset; readers need not wait for the file.
+  if (journalSnapshotDue >= 0) {
+    writeJournalSnapshot(journalSnapshotDue);
+    journalSnapshotDue = -1;
+  }
+}
+
+void releaseWarehouses() {
+  for (int w = 0; w < warehouseCount; w++) {
+    Warehouse *wh = &warehouses[w];
+    releaseSnapshot(wh->snapshots.current);
+    releaseTables(&wh->catalog, wh->materials, wh->transactions);
+    pthread_mutex_destroy(&wh->snapshots.lock);
+  }
+  warehouseCount = 0;
+  drainPools();
+}
+
+// IDs are shared: continue after the highest last ID of any shard
+void nextTransIdAfterAll(char *transID) {
+  int best = -1;
+  for (int w = 0; w < warehouseCount; w++) {
+    Warehouse *wh = &warehouses[w];
+    if (wh->transactionCount == 0) {
+      continue;
+    }
+    char *lastID = wh->transactions[wh->transactionCount - 1].transId;
+    int number = atoi(lastID + 1);
+    if (number > best) {
+      best = number;
+      sprintf(transID, "%c%03d", lastID[0], number + 1);
+    }
+  }
+}
+
+Warehouse *readWarehouse(char *announce) {
+  char code[10];
+  while (1) {
+    readValidLine(code, sizeof(code), announce, "Warehouse code");
+    Warehouse *wh = findWarehouse(code);
+    if (wh != NULL) {
+      return wh;
+    }
+    logToConsole("error", "Warehouse not found.\n");
+  }
+}
+
+void printWarehouseCodes() {
+  printf("Warehouses:");
+  for (int w = 0; w < warehouseCount; w++) {
+    printf(" %s", warehouses[w].code);
+  }
+  printf("\n");
+}
+
+void switchWarehouse() {
+  if (warehouseCount < 2) {
+    logToConsole("error", "Only one warehouse is configured.\n\n");
+    return;
+  }
+  printWarehouseCodes();
+  active = readWarehouse("Enter warehouse code: ");
+  printf(BLUE "Now working in warehouse %s.\n\n" RESET, active->code);
+}
+
+// Move qty of the material in slot src from one shard to another. Every
+// check and allocation happens before either shard changes, and
+// commitWarehouses publishes both shards together, so readers see the
+// stock in exactly one place. With mapped catalogs the move is logged in
+// one of them first, so a crash cannot leave it half done.
+int moveStock(Warehouse *from, Warehouse *to, int src, int qty,
+              char *transID) {
+  Material *m = &from->materials[src];
+  int dst = findMaterialIndexById(to->materials, m->matId, to->materialCount);
+
+  if (m->status == 0 || (dst != -1 && to->materials[dst].status == 0)) {
+    logToConsole("error", "Material is locked/expired in one warehouse.\n");
+    return -1;
+  }
+  if (qty <= 0) {
+    logToConsole("error", "Amount must be greater than zero.\n");
+    return -1;
+  }
+  if (qty > m->qty) {
+    logToConsole("error", "Amount exceeds the quantity on hand.\n");
+    return -1;
+  }
+  if (from->transactionCount >= MAX_TRANS_SIZE ||
+      to->transactionCount >= MAX_TRANS_SIZE ||
+      (dst == -1 && to->materialCount >= MAX_LIST_SIZE)) {
+    logToConsole("error", "Warehouse list reached max size.\n");
+    return -1;
+  }
+
+  Transaction *fromLog = reserveTransactionSlot(
+      &from->catalog, from->transactions, from->transactionCount + 1);
+  if (fromLog == NULL) {
+    logToConsole("error", "Allocate failed\n");
+    return -1;
+  }
+  from->transactions = fromLog;
+
+  Transaction *toLog = reserveTransactionSlot(&to->catalog, to->transactions,
+                                              to->transactionCount + 1);
+  if (toLog == NULL) {
+    logToConsole("error", "Allocate failed\n");
+    return -1;
+  }
+  to->transactions = toLog;
+
+  if (dst == -1) {
+    Material *grown = reserveMaterialSlot(&to->catalog, to->materials,
+                                          to->materialCount + 1);
+    if (grown == NULL) {
+      logToConsole("error", "Allocate failed\n");
+      return -1;
+    }
+    to->materials = grown;
+  }
+
+  // both records go past the visible counts, the commit reveals them
+  time_t now = time(NULL);
+  struct tm t;
+  localtime_r(&now, &t);
+  char dateStr[11];
+  strftime(dateStr, sizeof(dateStr), "%d/%m/%Y", &t);
+
+  int number = reserveTransIdBlock(transID, 2);
+  fillTransaction(&from->transactions[from->transactionCount], m->matId,
+                  transID[0], number, 2, dateStr);
+  fillTransaction(&to->transactions[to->transactionCount], m->matId,
+                  transID[0], number + 1, 1, dateStr);
+
+  MoveSide sides[2];
+  memset(sides, 0, sizeof(sides));
+  snprintf(sides[0].code, sizeof(sides[0].code), "%s", from->code);
+  sides[0].slot = src;
+  sides[0].row = *m;
+  sides[0].row.qty -= qty;
+  sides[0].materialCount = from->materialCount;
+  sides[0].transactionCount = from->transactionCount + 1;
+
+  snprintf(sides[1].code, sizeof(sides[1].code), "%s", to->code);
+  if (dst == -1) {
+    // first stock of this material in the destination; consumption
+    // history stays with the source warehouse
+    sides[1].slot = to->materialCount;
+    sides[1].row = *m;
+    sides[1].row.qty = 0;
+    sides[1].row.usage = 0;
+    sides[1].row.lastActivity = 0;
+    sides[1].materialCount = to->materialCount + 1;
+  } else {
+    sides[1].slot = dst;
+    sides[1].row = to->materials[dst];
+    sides[1].materialCount = to->materialCount;
+  }
+  sides[1].row.qty += qty;
+  sides[1].transactionCount = to->transactionCount + 1;
+
+  CatalogHeader *home = from->catalog.header != NULL ? from->catalog.header
+                                                     : to->catalog.header;
+  if (home != NULL) {
+    memcpy(home->move.sides, sides, sizeof(sides));
+    __atomic_store_n(&home->move.committed, 1, __ATOMIC_RELEASE);
+  }
+  applyMoveSide(from, &sides[0]);
+  applyMoveSide(to, &sides[1]);
+  if (home != NULL) {
+    __atomic_store_n(&home->move.committed, 0, __ATOMIC_RELEASE);
+  }
+
+  if (dst == -1) {
+    dst = sides[1].slot;
+    prefixIndexInsert(&to->index, to->materials, dst);
+  }
+  materialChanged(from, src);
+  materialChanged(to, dst);
+  return 0;
+}
+
+void applyMoveSide(Warehouse *wh, MoveSide *side) {
+  wh->materials[side->slot] = side->row;
+  wh->materialCount = side->materialCount;
+  wh->transactionCount = side->transactionCount;
+  syncCatalogCounts(&wh->catalog, wh->materialCount, wh->transactionCount);
+}
+
+// Redo a move a crash interrupted after its commit. The sides hold
+// absolute values, so redoing a finished side is harmless. Sides of
+// heap-backed warehouses kept nothing across the restart and are skipped.
+int finishPendingMoves() {
+  for (int w = 0; w < warehouseCount; w++) {
+    CatalogHeader *home = warehouses[w].catalog.header;
+    if (home == NULL || home->move.committed == 0) {
+      continue;
+    }
+
+    Warehouse *owners[2];
+    for (int k = 0; k < 2; k++) {
+      MoveSide *side = &home->move.sides[k];
+      side->code[sizeof(side->code) - 1] = '\0';
+      owners[k] = findWarehouse(side->code);
+      if (owners[k] == NULL) {
+        logfToConsole("error",
+                      "Warehouse %s holds an unfinished move to or from %s; "
+                      "open both to finish it.\n",
+                      warehouses[w].code, side->code);
+        return -1;
+      }
+      if (side->materialCount < 1 || side->materialCount > MAX_LIST_SIZE ||
+          side->slot < 0 || side->slot >= side->materialCount ||
+          side->transactionCount < 1 ||
+          side->transactionCount > MAX_TRANS_SIZE ||
+          side->row.unitCode >= units->count) {
+        logfToConsole("error", "Warehouse %s holds a damaged move record.\n",
+                      warehouses[w].code);
+        return -1;
+      }
+    }
+
+    for (int k = 0; k < 2; k++) {
+      Warehouse *wh = owners[k];
+      if (wh->catalog.header == NULL) {
+        continue;
+      }
+      applyMoveSide(wh, &home->move.sides[k]);
+      buildPrefixIndex(&wh->index, wh->materials, wh->materialCount);
+      buildBitmapIndex(&wh->bitmaps, wh->materials, wh->materialCount);
+      wh->tombstones = countTombstones(wh->materials, wh->materialCount);
+    }
+    home->move.committed = 0;
+    logToConsole("announce", "Finished an interrupted warehouse transfer.\n");
+  }
+  return 0;
+}
+
+void transferBetweenWarehouses(char *transID) {
+  if (warehouseCount < 2) {
+    logToConsole("error", "Only one warehouse is configured.\n\n");
+    return;
+  }
+
+  printWarehouseCodes();
+  Warehouse *from = readWarehouse("Enter source warehouse code: ");
+  Warehouse *to = readWarehouse("Enter destination warehouse code: ");
+  if (from == to) {
+    logToConsole("error", "Source and destination must differ.\n\n");
+    return;
+  }
+
+  char id[10];
+  readValidLine(id, sizeof(id), "Enter id of material: ", "ID");
+  int src = findMaterialIndexById(from->materials, id, from->materialCount);
+  if (src == -1) {
+    logToConsole("error", "ID not found in source warehouse\n\n");
+    return;
+  }
+  showCurrentInfo(from->materials, src);
+
+  int qty;
+  readInt(&qty, "Enter amount to move ( must be greater than 0 ): ",
+          "Amount of material");
+
+  if (moveStock(from, to, src, qty, transID) == 0) {
+    printf(BLUE "Moved %d %s of %s from %s to %s.\n\n" RESET, qty,
+           unitName(from->materials[src].unitCode), id, from->code, to->code);
+  }
+}
+
+// ======= Cross-warehouse queries =======
+// Each shard is scanned on its own thread over a snapshot; all snapshots
+// are taken under publishLock so they belong to the same commit.
+void acquireAllSnapshots(Snapshot **snaps) {
+  pthread_mutex_lock(&publishLock);
+  for (int w = 0; w < warehouseCount; w++) {
+    snaps[w] = acquireSnapshot(&warehouses[w].snapshots);
+  }
+  pthread_mutex_unlock(&publishLock);
+}
+
+void releaseAllSnapshots(Snapshot **snaps) {
+  for (int w = 0; w < warehouseCount; w++) {
+    releaseSnapshot(snaps[w]);
+  }
+}
+
+// run fn once per shard in parallel, jobs is an array of jobSize structs
+void runOnShards(void *(*fn)(void *), void *jobs, size_t jobSize) {
+  pthread_t threads[MAX_WAREHOUSES];
+  bool started[MAX_WAREHOUSES];
+
+  for (int w = 0; w < warehouseCount; w++) {
+    void *job = (char *)jobs + w * jobSize;
+    started[w] = pthread_create(&threads[w], NULL, fn, job) == 0;
+    if (!started[w]) {
+      fn(job); // no thread available, do it here
+    }
+  }
+  for (int w = 0; w < warehouseCount; w++) {
+    if (started[w]) {
+      pthread_join(threads[w], NULL);
+    }
+  }
+}
+
+typedef struct {
+  Snapshot *snap;
+  const char *target;
+  bool byId; // matched the exact ID instead of the name
+  int matchCount;
+  int matches[MAX_LIST_SIZE];
+} ShardSearch;
+
+void *searchShard(void *arg) {
+  ShardSearch *job = arg;
+  job->matchCount = 0;
+  job->byId = false;
+
+  for (int i = 0; i < job->snap->materialCount; i++) {
+    Material *m = snapshotMaterial(job->snap, i);
+    if (!m->deleted && strcmp(m->matId, job->target) == 0) {
+      job->matches[job->matchCount++] = i;
+      job->byId = true;
+      return NULL;
+    }
+  }
+  for (int i = 0; i < job->snap->materialCount; i++) {
+    Material *m = snapshotMaterial(job->snap, i);
+    if (!m->deleted && containsIgnoreCase(m->name, (char *)job->target)) {
+      job->matches[job->matchCount++] = i;
+    }
+  }
+  return NULL;
+}
+
+void printShardMaterialHeader() {
+  printf("\n+-------+------------+-----------------------------------+-------"
+         "---+------------+------------+\n");
+  printf("| WH    |  Mat ID    | Name                              |   Qty  "
+         "  |   Unit     |  Status    |\n");
+  printf("+-------+------------+-----------------------------------+-------"
+         "---+------------+------------+\n");
+}
+
+// an exact ID in any warehouse beats name matches
+void findMaterialByIdOrName() {
+  char target[50];
+  readValidLine(target, sizeof(target), "Enter ID or Name to find: ", "target");
+
+  Snapshot *snaps[MAX_WAREHOUSES];
+  ShardSearch jobs[MAX_WAREHOUSES];
+  acquireAllSnapshots(snaps);
+  for (int w = 0; w < warehouseCount; w++) {
+    jobs[w].snap = snaps[w];
+    jobs[w].target = target;
+  }
+  runOnShards(searchShard, jobs, sizeof(ShardSearch));
+
+  bool anyId = false;
+  for (int w = 0; w < warehouseCount; w++) {
+    anyId |= jobs[w].byId;
+  }
+
+  int shown = 0;
+  for (int w = 0; w < warehouseCount; w++) {
+    if (jobs[w].byId != anyId) {
+      continue;
+    }
+    for (int k = 0; k < jobs[w].matchCount; k++) {
+      Material *m = snapshotMaterial(snaps[w], jobs[w].matches[k]);
+      if (shown++ == 0) {
+        printShardMaterialHeader();
+      }
+      printf("| %-5s | %-10s | %-33s | %8d | %-10s | %-10s |\n",
+             warehouses[w].code, m->matId, m->name, m->qty,
+             unitName(m->unitCode), m->status ? "Active" : "Expired");
+    }
+  }
+  releaseAllSnapshots(snaps);
+
+  if (shown == 0) {
+    logToConsole("error", "No material matched in any warehouse.\n\n");
+    return;
+  }
+  printf("+-------+------------+-----------------------------------+-------"
+         "---+------------+------------+\n\n");
+}
+
+typedef struct {
+  Snapshot *snap;
+  int count;
+  Material *rows[MAX_LIST_SIZE]; // sorted by matId
+} ShardTotals;
+
+int compareMaterialRowsById(const void *a, const void *b) {
+  return strcmp((*(Material **)a)->matId, (*(Material **)b)->matId);
+}
+
+void *collectShardTotals(void *arg) {
+  ShardTotals *job = arg;
+  job->count = 0;
+  for (int i = 0; i < job->snap->materialCount; i++) {
+    Material *m = snapshotMaterial(job->snap, i);
+    if (!m->deleted) {
+      job->rows[job->count++] = m;
+    }
+  }
+  qsort(job->rows, job->count, sizeof(Material *), compareMaterialRowsById);
+  return NULL;
+}
+
+void displayTotalsAcrossWarehouses() {
+  Snapshot *snaps[MAX_WAREHOUSES];
+  ShardTotals *jobs = arenaAlloc(MAX_WAREHOUSES * sizeof(ShardTotals));
+  if (jobs == NULL) {
+    logToConsole("error", "Memory allocation failed.\n");
+    return;
+  }
+
+  acquireAllSnapshots(snaps);
+  for (int w = 0; w < warehouseCount; w++) {
+    jobs[w].snap = snaps[w];
+  }
+  runOnShards(collectShardTotals, jobs, sizeof(ShardTotals));
+
+  logToConsole("border", "\nMATERIAL TOTALS (all warehouses)\n");
+  printf("+------------+-----------------------------------+----------+-------"
+         "-----------------------+\n");
+  printf("| Mat ID     | Name                              |  Total   | By "
+         "warehouse                 |\n");
+  printf("+------------+-----------------------------------+----------+-------"
+         "-----------------------+\n");
+
+  // k-way merge of the per-shard ID-sorted lists
+  int pos[MAX_WAREHOUSES] = {0};
+  while (1) {
+    Material *head = NULL;
+    for (int w = 0; w < warehouseCount; w++) {
+      if (pos[w] < jobs[w].count &&
+          (head == NULL ||
+           strcmp(jobs[w].rows[pos[w]]->matId, head->matId) < 0)) {
+        head = jobs[w].rows[pos[w]];
+      }
+    }
+    if (head == NULL) {
+      break;
+    }
+
+    long total = 0;
+    char breakdown[64] = "";
+    size_t used = 0;
+    for (int w = 0; w < warehouseCount; w++) {
+      if (pos[w] < jobs[w].count &&
+          strcmp(jobs[w].rows[pos[w]]->matId, head->matId) == 0) {
+        int qty = jobs[w].rows[pos[w]]->qty;
+        total += qty;
+        if (used < sizeof(breakdown)) {
+          used += snprintf(breakdown + used, sizeof(breakdown) - used,
+                           "%s%s:%d", used > 0 ? " " : "",
+                           warehouses[w].code, qty);
+        }
+        pos[w]++;
+      }
+    }
+    printf("| %-10s | %-33s | %8ld | %-28.28s |\n", head->matId, head->name,
+           total, breakdown);
+  }
+  printf("+------------+-----------------------------------+----------+-------"
+         "-----------------------+\n\n");
+
+  releaseAllSnapshots(snaps);
+}
+
+// ======= Deletion and compaction =======
+int liveSlots(Material *materials, int materialCount, int *slots) {
+  int count = 0;
+  for (int i = 0; i < materialCount; i++) {
+    if (!materials[i].deleted) {
+      slots[count++] = i;
+    }
+  }
+  return count;
+}
+
+void deleteMaterial(Warehouse *wh) {
+  Material *materials = wh->materials;
+  int materialCount = wh->materialCount;
+
+  if (materialCount == 0) {
+    logToConsole("error", "Material list is empty.\n\n");
+    return;
+  }
+
+  char id[10];
+  readValidLine(id, sizeof(id), "Enter material ID to delete: ", "ID");
+
+  int idx = findMaterialIndexById(materials, id, materialCount);
+  if (idx == -1) {
+    logToConsole("error", "Material with this ID was not found.\n\n");
+    return;
+  }
+  showCurrentInfo(materials, idx);
+
+  char answer[5];
+  readValidLine(answer, sizeof(answer), "Delete this material? (y/n): ",
+                "Answer");
+  if (answer[0] != 'y' && answer[0] != 'Y') {
+    logToConsole("announce", "Delete cancelled.\n\n");
+    return;
+  }
+
+  // the row stays as a tombstone until compaction drops it
+  materials[idx].deleted = 1;
+  prefixIndexRemove(&wh->index, idx);
+  materialChanged(wh, idx);
+  wh->tombstones++;
+  maybeStartCompaction(wh);
+
+  printf(BLUE "Material %s deleted.\n\n" RESET, id);
+}
+
+int countTombstones(Material *materials, int materialCount) {
+  int count = 0;
+  for (int i = 0; i < materialCount; i++) {
+    count += materials[i].deleted != 0;
+  }
+  return count;
+}
+
+void maybeStartCompaction(Warehouse *wh) {
+  if (!wh->compacting && wh->tombstones >= COMPACT_MIN_TOMBSTONES &&
+      wh->tombstones * 4 >= wh->materialCount) {
+    wh->compacting = true;
+    wh->compactRead = 0;
+    wh->compactWrite = 0;
+  }
+}
+
+// Slide up to budget live rows down over the tombstones. A moved row's old
+// slot becomes a tombstone too, so scans never see it twice. Transactions
+// refer to materials by ID and need no rewrite.
+void compactStep(Warehouse *wh, int budget) {
+  if (!wh->compacting) {
+    return;
+  }
+
+  Material *m = wh->materials;
+  while (budget-- > 0 && wh->compactRead < wh->materialCount) {
+    int from = wh->compactRead++;
+    if (m[from].deleted) {
+      continue;
+    }
+
+    int to = wh->compactWrite++;
+    if (from != to) {
+      m[to] = m[from];
+      m[from].deleted = 1;
+      prefixIndexRemap(&wh->index, from, to);
+      materialChanged(wh, to);
+      materialChanged(wh, from);
+    }
+  }
+
+  if (wh->compactRead >= wh->materialCount) {
+    // everything past compactWrite is a tombstone now; rows deleted below
+    // compactWrite during the pass are still there and stay counted
+    wh->materialCount = wh->compactWrite;
+    wh->tombstones = countTombstones(wh->materials, wh->materialCount);
+    wh->compacting = false;
+    maybeStartCompaction(wh);
+  }
+}
+
+void finishCompaction(Warehouse *wh) {
+  while (wh->compacting) {
+    compactStep(wh, MAX_LIST_SIZE);
+  }
+}
+
+// ======= Bitmap indexes =======
+void bitmapSet(Bitmap *bm, int slot, bool on) {
+  uint64_t bit = (uint64_t)1 << (slot % 64);
+  if (on) {
+    bm->words[slot / 64] |= bit;
+  } else {
+    bm->words[slot / 64] &= ~bit;
+  }
+}
+
+void bitmapAnd(Bitmap *out, const Bitmap *a, const Bitmap *b) {
+  for (int w = 0; w < BITMAP_WORDS; w++) {
+    out->words[w] = a->words[w] & b->words[w];
+  }
+}
+
+void bitmapOr(Bitmap *out, const Bitmap *a, const Bitmap *b) {
+  for (int w = 0; w < BITMAP_WORDS; w++) {
+    out->words[w] = a->words[w] | b->words[w];
+  }
+}
+
+int bitmapCount(const Bitmap *bm) {
+  int count = 0;
+  for (int w = 0; w < BITMAP_WORDS; w++) {
+    count += __builtin_popcountll(bm->words[w]);
+  }
+  return count;
+}
+
+// slot of the k-th set bit (0-based), -1 if there are not that many
+int bitmapSelect(const Bitmap *bm, int k) {
+  for (int w = 0; w < BITMAP_WORDS; w++) {
+    int inWord = __builtin_popcountll(bm->words[w]);
+    if (k >= inWord) {
+      k -= inWord;
+      continue;
+    }
+    uint64_t bits = bm->words[w];
+    while (k-- > 0) {
+      bits &= bits - 1; // drop the lowest set bit
+    }
+    return w * 64 + __builtin_ctzll(bits);
+  }
+  return -1;
+}
+
+// recompute every bitmap's bit for one slot from the record
+void bitmapIndexUpdate(BitmapIndex *bx, Material *materials, int materialCount,
+                       int slot) {
+  bool live = slot < materialCount && !materials[slot].deleted;
+  Material *m = &materials[slot];
+
+  bitmapSet(&bx->live, slot, live);
+  bitmapSet(&bx->active, slot, live && m->status == 1);
+  bitmapSet(&bx->expired, slot, live && m->status == 0);
+  bitmapSet(&bx->lowStock, slot, live && m->qty < REORDER_POINT);
+  for (int code = 0; code < MAX_UNITS; code++) {
+    bitmapSet(&bx->unit[code], slot, live && m->unitCode == code);
+  }
+}
+
+void buildBitmapIndex(BitmapIndex *bx, Material *materials,
+                      int materialCount) {
+  memset(bx, 0, sizeof(BitmapIndex));
+  for (int i = 0; i < materialCount; i++) {
+    bitmapIndexUpdate(bx, materials, materialCount, i);
+  }
+}
+
+// every write to a material row goes through here
+void materialChanged(Warehouse *wh, int slot) {
+  markMaterialDirty(&wh->snapshots, slot);
+  bitmapSet(&wh->journalPending, slot, true);
+  bitmapIndexUpdate(&wh->bitmaps, wh->materials, wh->materialCount, slot);
+}
+
+// rows were moved around wholesale (sorting)
+void tableChanged(Warehouse *wh) {
+  markAllMaterialsDirty(&wh->snapshots);
+  for (int i = 0; i < wh->materialCount; i++) {
+    bitmapSet(&wh->journalPending, i, true);
+  }
+  buildBitmapIndex(&wh->bitmaps, wh->materials, wh->materialCount);
+}
+
+typedef struct {
+  Material *materials;
+  const Bitmap *rows;
+} BitmapSource;
+
+Material *bitmapRowAt(void *source, int i) {
+  BitmapSource *src = source;
+  return &src->materials[bitmapSelect(src->rows, i)];
+}
+
+void displayFilteredList(Warehouse *wh) {
+  Material *materials = wh->materials;
+  BitmapIndex *bx = &wh->bitmaps;
+
+  int status = readStatusFilter();
+
+  // resolved now: the line is only valid until the next read
+  Span unit;
+  printf("Unit filter (empty = any unit): ");
+  int got = readLine(&unit);
+  if (got == 0) {
+    return;
+  }
+  if (got < 0) {
+    logToConsole("error", "Unit is too long.\n\n");
+    return;
+  }
+  int code = -2; // any unit
+  unit = trimSpan(unit);
+  if (unit.len > 0) {
+    unit.start[unit.len] = '\0'; // drops trailing blanks in place
+    code = findUnitCode(unit.start);
+  }
+  // rejected before the next question, not after it
+  if (code == -1) {
+    logToConsole("error", "Unknown unit.\n\n");
+    return;
+  }
+
+  char answer[5];
+  readValidLine(answer, sizeof(answer), "Only below reorder point? (y/n): ",
+                "Answer");
+
+  Bitmap rows = bx->live;
+  if (status != 2) {
+    bitmapAnd(&rows, &rows, status == 1 ? &bx->active : &bx->expired);
+  }
+  if (code != -2) {
+    bitmapAnd(&rows, &rows, &bx->unit[code]);
+  }
+  if (answer[0] == 'y' || answer[0] == 'Y') {
+    bitmapAnd(&rows, &rows, &bx->lowStock);
+  }
+
+  BitmapSource source = {materials, &rows};
+  MaterialView view = {bitmapCount(&rows), bitmapRowAt, &source, NULL};
+  displayMaterialView(&view, "FILTERED MATERIAL LIST");
+}
+
+void reportStatusCounts() {
+  BitmapIndex *bx = &active->bitmaps;
+
+  Bitmap attention;
+  bitmapAnd(&attention, &bx->active, &bx->lowStock);
+  Bitmap inactiveOrLow;
+  bitmapOr(&inactiveOrLow, &bx->expired, &bx->lowStock);
+
+  logToConsole("border", "\nSTATUS AND STOCK COUNTS\n");
+  printf("Materials          : %d\n", bitmapCount(&bx->live));
+  printf("Active             : %d\n", bitmapCount(&bx->active));
+  printf("Expired            : %d\n", bitmapCount(&bx->expired));
+  printf("Below reorder (%d) : %d\n", REORDER_POINT,
+         bitmapCount(&bx->lowStock));
+  printf("Active and low     : %d\n", bitmapCount(&attention));
+  printf("Expired or low     : %d\n\n", bitmapCount(&inactiveOrLow));
+}
+
+// ======= Filter expressions =======
+// next token: a "quoted string", a run of operator characters or a word
+const char *nextFilterToken(const char *p, char *token, size_t size) {
+  while (isspace((unsigned char)*p)) {
+    p++;
+  }
+  if (*p == '\0') {
+    return NULL;
+  }
+
+  size_t len = 0;
+  if (*p == '"') {
+    p++;
+    while (*p != '\0' && *p != '"') {
+      if (len + 1 < size) {
+        token[len++] = *p;
+      }
+      p++;
+    }
+    if (*p == '"') {
+      p++;
+    }
+  } else if (strchr("<>=!", *p) != NULL) {
+    while (*p != '\0' && strchr("<>=!", *p) != NULL) {
+      if (len + 1 < size) {
+        token[len++] = *p;
+      }
+      p++;
+    }
+  } else {
+    while (*p != '\0' && !isspace((unsigned char)*p) &&
+           strchr("<>=!\"", *p) == NULL) {
+      if (len + 1 < size) {
+        token[len++] = *p;
+      }
+      p++;
+    }
+  }
+  token[len] = '\0';
+  return p;
+}
+
+int parseFilterField(const char *word, FilterField *field) {
+  static const char *names[] = {"qty", "status", "unit", "id", "name"};
+  for (int i = 0; i < 5; i++) {
+    if (strcasecmp(word, names[i]) == 0) {
+      *field = (FilterField)i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int parseFilterOp(const char *word, FilterOp *op) {
+  static const struct {
+    const char *text;
+    FilterOp op;
+  } ops[] = {{"=", OP_EQ},  {"==", OP_EQ}, {"!=", OP_NE},
+             {"<", OP_LT},  {"<=", OP_LE}, {">", OP_GT},
+             {">=", OP_GE}, {"contains", OP_CONTAINS}};
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    if (strcasecmp(word, ops[i].text) == 0) {
+      *op = ops[i].op;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// resolve one predicate's value; status and unit become integer codes
+int bindPredicate(Predicate *pred, const char *value, char *error,
+                  size_t errorSize) {
+  bool ordering = pred->op != OP_EQ && pred->op != OP_NE;
+
+  switch (pred->field) {
+  case FIELD_QTY: {
+    char *end;
+    long number = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || number < -2147483647L ||
+        number > 2147483647L || pred->op == OP_CONTAINS) {
+      snprintf(error, errorSize, "qty needs a comparison with a number");
+      return -1;
+    }
+    pred->number = (int)number;
+    return 0;
+  }
+  case FIELD_STATUS: {
+    if (ordering) {
+      snprintf(error, errorSize, "status only supports = and !=");
+      return -1;
+    }
+    if (strcasecmp(value, "active") == 0 || strcmp(value, "1") == 0) {
+      pred->number = 1;
+    } else if (strcasecmp(value, "expired") == 0 || strcmp(value, "0") == 0) {
+      pred->number = 0;
+    } else {
+      snprintf(error, errorSize, "status is active or expired");
+      return -1;
+    }
+    return 0;
+  }
+  case FIELD_UNIT: {
+    if (ordering) {
+      snprintf(error, errorSize, "unit only supports = and !=");
+      return -1;
+    }
+    pred->number = findUnitCode(value);
+    if (pred->number == -1) {
+      snprintf(error, errorSize, "unknown unit %s", value);
+      return -1;
+    }
+    return 0;
+  }
+  case FIELD_ID:
+  case FIELD_NAME: {
+    if (ordering && pred->op != OP_CONTAINS) {
+      snprintf(error, errorSize, "id and name support =, != and contains");
+      return -1;
+    }
+    snprintf(pred->text, sizeof(pred->text), "%s", value);
+    return 0;
+  }
+  }
+  return -1;
+}
+
+// predicates joined by AND, e.g. qty < 50 AND status = active
+int compileFilter(const char *text, FilterPlan *plan, char *error,
+                  size_t errorSize) {
+  char word[50];
+  const char *p = text;
+
+  plan->numericCount = 0;
+  plan->stringCount = 0;
+
+  do {
+    Predicate pred = {0};
+
+    p = nextFilterToken(p, word, sizeof(word));
+    if (p == NULL || parseFilterField(word, &pred.field) == -1) {
+      snprintf(error, errorSize, "expected qty, status, unit, id or name");
+      return -1;
+    }
+    p = nextFilterToken(p, word, sizeof(word));
+    if (p == NULL || parseFilterOp(word, &pred.op) == -1) {
+      snprintf(error, errorSize, "expected an operator");
+      return -1;
+    }
+    p = nextFilterToken(p, word, sizeof(word));
+    if (p == NULL) {
+      snprintf(error, errorSize, "expected a value");
+      return -1;
+    }
+    if (bindPredicate(&pred, word, error, errorSize) == -1) {
+      return -1;
+    }
+
+    bool isString = pred.field == FIELD_ID || pred.field == FIELD_NAME;
+    int *count = isString ? &plan->stringCount : &plan->numericCount;
+    if (*count == MAX_PREDICATES) {
+      snprintf(error, errorSize, "too many predicates");
+      return -1;
+    }
+    if (isString) {
+      plan->strings[(*count)++] = pred;
+    } else {
+      plan->numeric[(*count)++] = pred;
+    }
+
+    p = nextFilterToken(p, word, sizeof(word));
+    if (p != NULL && strcasecmp(word, "and") != 0) {
+      snprintf(error, errorSize, "expected AND between predicates");
+      return -1;
+    }
+  } while (p != NULL);
+
+  return 0;
+}
+
+// one numeric predicate over a gathered column; the compare loops have
+// no branches so the compiler can vectorize them
+uint64_t numericMask(const Predicate *pred, const int *column, int n) {
+  unsigned char hit[FILTER_BLOCK_ROWS];
+  int v = pred->number;
+
+  switch (pred->op) {
+  case OP_EQ:
+    for (int i = 0; i < n; i++)
+      hit[i] = column[i] == v;
+    break;
+  case OP_NE:
+    for (int i = 0; i < n; i++)
+      hit[i] = column[i] != v;
+    break;
+  case OP_LT:
+    for (int i = 0; i < n; i++)
+      hit[i] = column[i] < v;
+    break;
+  case OP_LE:
+    for (int i = 0; i < n; i++)
+      hit[i] = column[i] <= v;
+    break;
+  case OP_GT:
+    for (int i = 0; i < n; i++)
+      hit[i] = column[i] > v;
+    break;
+  case OP_GE:
+    for (int i = 0; i < n; i++)
+      hit[i] = column[i] >= v;
+    break;
+  case OP_CONTAINS:
+    return 0;
+  }
+
+  uint64_t mask = 0;
+  for (int i = 0; i < n; i++) {
+    mask |= (uint64_t)hit[i] << i;
+  }
+  return mask;
+}
+
+bool stringMatches(const Predicate *pred, Material *m) {
+  char *value = pred->field == FIELD_ID ? m->matId : m->name;
+  bool match;
+  if (pred->op == OP_CONTAINS) {
+    match = containsIgnoreCase(value, (char *)pred->text);
+  } else {
+    match = strcasecmp(value, pred->text) == 0;
+  }
+  return pred->op == OP_NE ? !match : match;
+}
+
+// fills slots with matching rows in table order, returns how many
+int runFilter(const FilterPlan *plan, Warehouse *wh, int *slots) {
+  int found = 0;
+
+  for (int base = 0; base < wh->materialCount; base += FILTER_BLOCK_ROWS) {
+    int n = wh->materialCount - base;
+    if (n > FILTER_BLOCK_ROWS) {
+      n = FILTER_BLOCK_ROWS;
+    }
+    Material *block = &wh->materials[base];
+
+    // blocks line up with bitmap words, so tombstones drop out for free
+    uint64_t mask = wh->bitmaps.live.words[base / 64];
+    int column[FILTER_BLOCK_ROWS];
+    for (int p = 0; p < plan->numericCount && mask != 0; p++) {
+      const Predicate *pred = &plan->numeric[p];
+      for (int i = 0; i < n; i++) {
+        column[i] = pred->field == FIELD_QTY      ? block[i].qty
+                    : pred->field == FIELD_STATUS ? block[i].status
+                                                  : block[i].unitCode;
+      }
+      mask &= numericMask(pred, column, n);
+    }
+
+    while (mask != 0) {
+      int i = __builtin_ctzll(mask);
+      mask &= mask - 1;
+
+      bool keep = true;
+      for (int p = 0; p < plan->stringCount && keep; p++) {
+        keep = stringMatches(&plan->strings[p], &block[i]);
+      }
+      if (keep) {
+        slots[found++] = base + i;
+      }
+    }
+  }
+  return found;
+}
+
+void queryMaterials(Warehouse *wh) {
+  char text[256];
+  printf("Fields: qty, status, unit, id, name. Operators: = != < <= > >= "
+         "contains.\n");
+  printf("Join predicates with AND, e.g. qty < 50 AND name contains bolt\n");
+  readValidLine(text, sizeof(text), "Filter: ", "Filter");
+
+  FilterPlan plan;
+  char error[100];
+  if (compileFilter(text, &plan, error, sizeof(error)) == -1) {
+    printf(RED "Invalid filter: %s\n\n" RESET, error);
+    return;
+  }
+
+  int slots[MAX_LIST_SIZE];
+  int count = runFilter(&plan, wh, slots);
+  MaterialView view = {count, arrayRowAt, wh->materials, slots};
+  displayMaterialView(&view, "QUERY RESULT");
+}
+
+// ======= Journal (primary side) =======
+void fillJournalFormat(JournalFormat *format, const char *magic) {
+  memset(format, 0, sizeof(JournalFormat));
+  memcpy(format->magic, magic, sizeof(format->magic));
+  format->version = JOURNAL_VERSION;
+  format->recordSize = sizeof(JournalRecord);
+  format->materialSize = sizeof(Material);
+  format->transactionSize = sizeof(Transaction);
+}
+
+bool journalFormatMatches(const JournalFormat *format, const char *magic) {
+  JournalFormat expected;
+  fillJournalFormat(&expected, magic);
+  return memcmp(format, &expected, sizeof(JournalFormat)) == 0;
+}
+
+int openJournal(const char *path) {
+  journal = fopen(path, "a+b");
+  if (journal == NULL) {
+    logfToConsole("error", "Cannot open journal %s\n", path);
+    return -1;
+  }
+
+  // a new journal gets the format header, an old one must match it
+  JournalFormat format;
+  fseek(journal, 0, SEEK_END);
+  if (ftell(journal) == 0) {
+    fillJournalFormat(&format, JOURNAL_MAGIC);
+    fwrite(&format, sizeof(format), 1, journal);
+    fflush(journal);
+  } else {
+    rewind(journal);
+    if (fread(&format, sizeof(format), 1, journal) != 1 ||
+        !journalFormatMatches(&format, JOURNAL_MAGIC)) {
+      logfToConsole("error", "Journal %s has an incompatible format.\n",
+                    path);
+      closeJournal();
+      return -1;
+    }
+    fseek(journal, 0, SEEK_END);
+  }
+  snprintf(journalSnapshotPath, sizeof(journalSnapshotPath), "%s.snap",
+           path);
+
+  // a new session starts with a full image, so the journal never depends
+  // on what an earlier run wrote
+  journalAnnounce = true;
+  journaledUnits = 0;
+  journalCommits = 0;
+  for (int w = 0; w < warehouseCount; w++) {
+    Warehouse *wh = &warehouses[w];
+    for (int i = 0; i < wh->materialCount; i++) {
+      bitmapSet(&wh->journalPending, i, true);
+    }
+    wh->journaledMaterials = -1;
+    wh->journaledTransactions = 0;
+  }
+  return 0;
+}
+
+void journalWrite(int kind, int warehouse, int slot, int count,
+                  const void *row, size_t rowSize) {
+  JournalRecord rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.kind = kind;
+  rec.warehouse = warehouse;
+  rec.slot = slot;
+  rec.count = count;
+  if (row != NULL) {
+    memcpy(&rec.row, row, rowSize);
+  }
+  if (kind == JOURNAL_COMMIT) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec.stamp = (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+  }
+  fwrite(&rec, sizeof(rec), 1, journal);
+}
+
+bool writeAll(int fd, const void *data, size_t size) {
+  const char *p = data;
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// all shards at the journal offset given, written aside and renamed in
+void writeJournalSnapshot(long journalOffset) {
+  char tmpPath[sizeof(journalSnapshotPath) + 4];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", journalSnapshotPath);
+
+  // plain write(): stdio would allocate a FILE on every snapshot
+  int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return;
+  }
+
+  JournalSnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  fillJournalFormat(&header.format, JOURNAL_SNAPSHOT_MAGIC);
+  header.journalOffset = journalOffset;
+  header.warehouseCount = warehouseCount;
+  header.units = *units;
+  bool ok = writeAll(fd, &header, sizeof(header));
+
+  for (int w = 0; w < warehouseCount && ok; w++) {
+    Warehouse *wh = &warehouses[w];
+    ok = writeAll(fd, wh->code, sizeof(wh->code)) &&
+         writeAll(fd, &wh->materialCount, sizeof(int)) &&
+         writeAll(fd, &wh->transactionCount, sizeof(int)) &&
+         writeAll(fd, wh->materials, wh->materialCount * sizeof(Material)) &&
+         writeAll(fd, wh->transactions,
+                  wh->transactionCount * sizeof(Transaction));
+  }
+
+  if (close(fd) != 0 || !ok || rename(tmpPath, journalSnapshotPath) != 0) {
+    unlink(tmpPath);
+  }
+}
+
+// Append what changed since the last commit as one group. Called with
+// publishLock held, so the group matches the published snapshots.
+void journalCommit() {
+  if (journal == NULL) {
+    return;
+  }
+
+  bool changed = false;
+  if (journalAnnounce) {
+    for (int w = 0; w < warehouseCount; w++) {
+      journalWrite(JOURNAL_WAREHOUSE, w, 0, 0, warehouses[w].code,
+                   sizeof(warehouses[w].code));
+    }
+    journalAnnounce = false;
+    changed = true;
+  }
+
+  for (; journaledUnits < units->count; journaledUnits++) {
+    journalWrite(JOURNAL_UNIT, -1, journaledUnits, 0,
+                 units->names[journaledUnits],
+                 sizeof(units->names[journaledUnits]));
+    changed = true;
+  }
+
+  for (int w = 0; w < warehouseCount; w++) {
+    Warehouse *wh = &warehouses[w];
+    bool rowsChanged = false;
+
+    for (int word = 0; word < BITMAP_WORDS; word++) {
+      uint64_t bits = wh->journalPending.words[word];
+      while (bits != 0) {
+        int slot = word * 64 + __builtin_ctzll(bits);
+        bits &= bits - 1;
+        if (slot < wh->materialCount) {
+          journalWrite(JOURNAL_MATERIAL, w, slot, 0, &wh->materials[slot],
+                       sizeof(Material));
+          rowsChanged = true;
+        }
+      }
+    }
+    memset(&wh->journalPending, 0, sizeof(Bitmap));
+
+    if (wh->journaledTransactions > wh->transactionCount) {
+      wh->journaledTransactions = wh->transactionCount;
+    }
+    for (int t = wh->journaledTransactions; t < wh->transactionCount; t++) {
+      journalWrite(JOURNAL_TRANSACTION, w, t, 0, &wh->transactions[t],
+                   sizeof(Transaction));
+      rowsChanged = true;
+    }
+
+    if (rowsChanged || wh->journaledMaterials != wh->materialCount ||
+        wh->journaledTransactions != wh->transactionCount) {
+      journalWrite(JOURNAL_COUNTS, w, wh->materialCount, wh->transactionCount,
+                   NULL, 0);
+      wh->journaledMaterials = wh->materialCount;
+      wh->journaledTransactions = wh->transactionCount;
+      changed = true;
+    }
+  }
+
+  // read-only commands leave nothing to write
+  if (!changed) {
+    return;
+  }
+
+  journalWrite(JOURNAL_COMMIT, -1, 0, 0, NULL, 0);
+  fflush(journal);
+
+  // written by commitWarehouses once publishLock is released
+  journalCommits++;
+  if (journalCommits == 1 || journalCommits % JOURNAL_SNAPSHOT_INTERVAL == 0) {
+    journalSnapshotDue = ftell(journal);
+  }
+}
+
+void closeJournal() {
+  if (journal != NULL) {
+    fclose(journal);
+    journal = NULL;
+  }
+}
+
+// ======= Read replica =======
+// The replica owns its own in-memory shards. A tailer thread applies
+// whole journal groups under replica.lock, and queries take the same lock,
+// so an answer never mixes two commits.
+Warehouse *replicaWarehouse(int index) {
+  if (index < 0 || index >= MAX_WAREHOUSES || replica.shardOf[index] < 0) {
+    return NULL;
+  }
+  return &warehouses[replica.shardOf[index]];
+}
+
+// Point journal index at the shard with this code, opening it on first
+// sight. The shards are matched by code, never by position.
+Warehouse *replicaMapWarehouse(int index, const char *code) {
+  if (index < 0 || index >= MAX_WAREHOUSES) {
+    return NULL;
+  }
+  Warehouse *wh = findWarehouse(code);
+  if (wh == NULL && openWarehouse(code, NULL, false) == 0) {
+    wh = &warehouses[warehouseCount - 1];
+  }
+  int shard = wh != NULL ? (int)(wh - warehouses) : -1;
+  for (int i = 0; i < MAX_WAREHOUSES; i++) {
+    if (replica.shardOf[i] == shard) {
+      replica.shardOf[i] = -1; // the code moved to another index
+    }
+  }
+  replica.shardOf[index] = shard;
+  if (wh != NULL && active == NULL) {
+    active = wh;
+  }
+  return wh;
+}
+
+// grow the tables to hold at least the given rows; new rows are tombstones
+int replicaReserve(Warehouse *wh, int materialCount, int transactionCount) {
+  if (materialCount > MAX_LIST_SIZE || transactionCount > MAX_TRANS_SIZE) {
+    return -1;
+  }
+  if (materialCount > wh->materialCount) {
+    Material *temp =
+        reserveMaterialSlot(&wh->catalog, wh->materials, materialCount);
+    if (temp == NULL) {
+      return -1;
+    }
+    wh->materials = temp;
+    memset(&wh->materials[wh->materialCount], 0,
+           (materialCount - wh->materialCount) * sizeof(Material));
+    for (int i = wh->materialCount; i < materialCount; i++) {
+      wh->materials[i].deleted = 1;
+    }
+    wh->materialCount = materialCount;
+  }
+  if (transactionCount > wh->transactionCount) {
+    Transaction *temp = reserveTransactionSlot(
+        &wh->catalog, wh->transactions, transactionCount);
+    if (temp == NULL) {
+      return -1;
+    }
+    wh->transactions = temp;
+    wh->transactionCount = transactionCount;
+  }
+  return 0;
+}
+
+void replicaApply(const JournalRecord *rec) {
+  Warehouse *wh = replicaWarehouse(rec->warehouse);
+
+  switch (rec->kind) {
+  case JOURNAL_WAREHOUSE: {
+    char code[sizeof(rec->row.text) + 1];
+    snprintf(code, sizeof(code), "%.*s", (int)sizeof(rec->row.text),
+             rec->row.text);
+    replicaMapWarehouse(rec->warehouse, code);
+    break;
+  }
+  case JOURNAL_UNIT: {
+    if (rec->slot >= 0 && rec->slot < MAX_UNITS) {
+      snprintf(units->names[rec->slot], sizeof(units->names[rec->slot]),
+               "%.*s", (int)sizeof(rec->row.text), rec->row.text);
+      if (rec->slot >= units->count) {
+        __atomic_store_n(&units->count, rec->slot + 1, __ATOMIC_RELEASE);
+      }
+    }
+    break;
+  }
+  case JOURNAL_MATERIAL: {
+    if (wh != NULL && rec->slot >= 0 &&
+        replicaReserve(wh, rec->slot + 1, 0) == 0) {
+      wh->materials[rec->slot] = rec->row.material;
+      materialChanged(wh, rec->slot);
+    }
+    break;
+  }
+  case JOURNAL_TRANSACTION: {
+    if (wh != NULL && rec->slot >= 0 &&
+        replicaReserve(wh, 0, rec->slot + 1) == 0) {
+      wh->transactions[rec->slot] = rec->row.transaction;
+      markTransactionsDirty(&wh->snapshots, rec->slot);
+    }
+    break;
+  }
+  case JOURNAL_COUNTS: {
+    if (wh != NULL && rec->slot >= 0 && rec->count >= 0 &&
+        replicaReserve(wh, rec->slot, rec->count) == 0) {
+      int oldCount = wh->materialCount;
+      wh->materialCount = rec->slot;
+      wh->transactionCount = rec->count;
+      for (int i = rec->slot; i < oldCount; i++) {
+        materialChanged(wh, i); // drops the slot from the bitmaps
+      }
+    }
+    break;
+  }
+  case JOURNAL_COMMIT: {
+    replica.lastStamp = rec->stamp;
+    break;
+  }
+  }
+}
+
+// Read the group starting at offset. Returns its size in bytes, 0 while
+// the primary is still writing it.
+long readJournalGroup(int fd, long offset, JournalRecord **group,
+                      int *capacity, int *count) {
+  *count = 0;
+  while (1) {
+    if (*count == *capacity) {
+      int grown = *capacity == 0 ? 64 : *capacity * 2;
+      JournalRecord *temp =
+          heapRealloc(*group, grown * sizeof(JournalRecord));
+      if (temp == NULL) {
+        return 0;
+      }
+      *group = temp;
+      *capacity = grown;
+    }
+
+    JournalRecord *rec = &(*group)[*count];
+    long at = offset + (long)*count * (long)sizeof(JournalRecord);
+    if (pread(fd, rec, sizeof(JournalRecord), at) !=
+        (ssize_t)sizeof(JournalRecord)) {
+      return 0;
+    }
+    (*count)++;
+    if (rec->kind == JOURNAL_COMMIT) {
+      return (long)*count * (long)sizeof(JournalRecord);
+    }
+  }
+}
+
+// Replace the replica's shards with the primary's snapshot. Unless forced,
+// only a snapshot ahead of what was already applied is used.
+int loadJournalSnapshot(bool force) {
+  FILE *file = fopen(replica.snapshotPath, "rb");
+  if (file == NULL) {
+    return -1;
+  }
+
+  JournalSnapshotHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      !journalFormatMatches(&header.format, JOURNAL_SNAPSHOT_MAGIC) ||
+      header.warehouseCount < 0 || header.warehouseCount > MAX_WAREHOUSES ||
+      header.units.count < 0 || header.units.count > MAX_UNITS ||
+      (!force && header.journalOffset <= replica.offset)) {
+    fclose(file);
+    return -1;
+  }
+
+  int result = 0;
+  pthread_mutex_lock(&replica.lock);
+  *units = header.units;
+  for (int w = 0; w < header.warehouseCount && result == 0; w++) {
+    char code[11] = {0};
+    int materialCount, transactionCount;
+    if (fread(code, 10, 1, file) != 1 ||
+        fread(&materialCount, sizeof(int), 1, file) != 1 ||
+        fread(&transactionCount, sizeof(int), 1, file) != 1 ||
+        materialCount < 0 || transactionCount < 0) {
+      result = -1;
+      break;
+    }
+    Warehouse *wh = replicaMapWarehouse(w, code);
+    if (wh == NULL ||
+        replicaReserve(wh, materialCount, transactionCount) != 0 ||
+        fread(wh->materials, sizeof(Material), materialCount, file) !=
+            (size_t)materialCount ||
+        fread(wh->transactions, sizeof(Transaction), transactionCount,
+              file) != (size_t)transactionCount) {
+      result = -1;
+      break;
+    }
+    wh->materialCount = materialCount;
+    wh->transactionCount = transactionCount;
+    buildPrefixIndex(&wh->index, wh->materials, wh->materialCount);
+    tableChanged(wh);
+    markTransactionsDirty(&wh->snapshots, 0);
+  }
+  if (result == 0) {
+    for (int w = header.warehouseCount; w < MAX_WAREHOUSES; w++) {
+      replica.shardOf[w] = -1;
+    }
+    replica.offset = header.journalOffset;
+    replica.snapshotLoads++;
+  }
+  pthread_mutex_unlock(&replica.lock);
+
+  fclose(file);
+  return result;
+}
+
+void *replicaTailer(void *arg) {
+  (void)arg;
+  JournalRecord *group = NULL;
+  int capacity = 0;
+  int count = 0;
+  int fd = -1;
+
+  while (!__atomic_load_n(&replica.stopping, __ATOMIC_ACQUIRE)) {
+    if (fd < 0) {
+      fd = open(replica.path, O_RDONLY);
+    }
+
+    // the header must be complete and match before any record is read
+    if (fd >= 0 && replica.offset < (long)sizeof(JournalFormat)) {
+      JournalFormat format;
+      ssize_t got = pread(fd, &format, sizeof(format), 0);
+      if (got == (ssize_t)sizeof(format) &&
+          !journalFormatMatches(&format, JOURNAL_MAGIC)) {
+        __atomic_store_n(&replica.incompatible, true, __ATOMIC_RELEASE);
+        break;
+      }
+      if (got == (ssize_t)sizeof(format)) {
+        pthread_mutex_lock(&replica.lock);
+        replica.offset = sizeof(format);
+        pthread_mutex_unlock(&replica.lock);
+      }
+    }
+
+    struct stat st;
+    if (fd >= 0 && replica.offset >= (long)sizeof(JournalFormat) &&
+        fstat(fd, &st) == 0) {
+      pthread_mutex_lock(&replica.lock);
+      replica.behind = st.st_size - replica.offset;
+      long behind = replica.behind;
+      pthread_mutex_unlock(&replica.lock);
+
+      // too far behind to replay, jump to the newest snapshot
+      if (behind / (long)sizeof(JournalRecord) > REPLICA_MAX_LAG_RECORDS) {
+        loadJournalSnapshot(false);
+      }
+
+      long size;
+      while ((size = readJournalGroup(fd, replica.offset, &group, &capacity,
+                                      &count)) > 0) {
+        pthread_mutex_lock(&replica.lock);
+        for (int i = 0; i < count; i++) {
+          replicaApply(&group[i]);
+        }
+        for (int w = 0; w < warehouseCount; w++) {
+          Warehouse *wh = &warehouses[w];
+          buildPrefixIndex(&wh->index, wh->materials, wh->materialCount);
+        }
+        replica.offset += size;
+        replica.behind = st.st_size - replica.offset;
+        if (replica.behind < 0) {
+          replica.behind = 0;
+        }
+        pthread_mutex_unlock(&replica.lock);
+      }
+    }
+
+    struct timespec pause = {0, REPLICA_POLL_MS * 1000000L};
+    nanosleep(&pause, NULL);
+  }
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  free(group);
+  return NULL;
+}
+
+// lag: journal records not applied yet and how old the replica's data is
+void printReplicaLag() {
+  long records = replica.behind / (long)sizeof(JournalRecord);
+  long long ageMs = 0;
+  if (records > 0 && replica.lastStamp != 0) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    ageMs = (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000 -
+            replica.lastStamp;
+  }
+  printf("%ld\t%lld\t%ld\t%d\n", records, ageMs, replica.offset,
+         replica.snapshotLoads);
+  printf("ok 1\n");
+}
+
+// Serve batch queries (read-only) from a replica of the journal's primary:
+//   lag                 records behind, ms behind, offset, snapshot loads
+//   warehouse <code>    answer from another shard
+// plus complete, show and filter as in batch mode.
+int runReplica(const char *path) {
+  batchOutput = true; // same line protocol as --batch
+  replica.path = path;
+  snprintf(replica.snapshotPath, sizeof(replica.snapshotPath), "%s.snap",
+           path);
+  for (int w = 0; w < MAX_WAREHOUSES; w++) {
+    replica.shardOf[w] = -1;
+  }
+
+  // start from the snapshot when there is one, else replay from the start
+  loadJournalSnapshot(true);
+
+  if (pthread_create(&replica.thread, NULL, replicaTailer, NULL) != 0) {
+    logToConsole("error", "Cannot start the journal tailer.\n");
+    return 1;
+  }
+
+  Span line;
+  int got;
+  while ((got = readLine(&line)) != 0) {
+    Span rest = line;
+    Span command = {"", 0};
+    Span arg = {"", 0};
+    nextField(&rest, &command);
+    nextField(&rest, &arg);
+
+    pthread_mutex_lock(&replica.lock);
+    bool more = true;
+    if (got < 0) {
+      printf("error line too long\n");
+    } else if (__atomic_load_n(&replica.incompatible, __ATOMIC_ACQUIRE) &&
+               !spanIs(command, "quit")) {
+      printf("error incompatible journal format\n");
+    } else if (spanIs(command, "lag")) {
+      printReplicaLag();
+    } else if (spanIs(command, "quit")) {
+      more = false;
+    } else if (active == NULL) {
+      printf("error no data yet\n");
+    } else if (spanIs(command, "warehouse") && arg.len > 0) {
+      arg.start[arg.len] = '\0'; // the code ends the line or a blank
+      Warehouse *wh = findWarehouse(arg.start);
+      if (wh == NULL) {
+        printf("error unknown warehouse\n");
+      } else {
+        active = wh;
+        printf("ok 1\n");
+      }
+    } else {
+      more = runBatchCommand(line, active, NULL);
+    }
+    pthread_mutex_unlock(&replica.lock);
+    fflush(stdout);
+    arenaReset();
+    if (!more) {
+      break;
+    }
+  }
+
+  __atomic_store_n(&replica.stopping, true, __ATOMIC_RELEASE);
+  pthread_join(replica.thread, NULL);
+  releaseWarehouses();
+  return 0;
+}
+
+// ======= Heap accounting =======
+void *heapAlloc(size_t size) {
+  __atomic_add_fetch(&wrapperAllocations, 1, __ATOMIC_RELAXED);
+  return malloc(size);
+}
+
+void *heapRealloc(void *p, size_t size) {
+  __atomic_add_fetch(&wrapperAllocations, 1, __ATOMIC_RELAXED);
+  return realloc(p, size);
+}
+
+// a recycled object if there is one, else a fresh one from the heap
+void *poolAlloc(Pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  PoolNode *node = pool->free;
+  if (node != NULL) {
+    pool->free = node->next;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return node != NULL ? (void *)node : heapAlloc(pool->size);
+}
+
+void poolFree(Pool *pool, void *p) {
+  PoolNode *node = p;
+  pthread_mutex_lock(&pool->lock);
+  node->next = pool->free;
+  pool->free = node;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// hand the free list back to the heap
+void poolDrain(Pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  PoolNode *node = pool->free;
+  pool->free = NULL;
+  pthread_mutex_unlock(&pool->lock);
+  while (node != NULL) {
+    PoolNode *next = node->next;
+    free(node);
+    node = next;
+  }
+}
+
+void drainPools() {
+  poolDrain(&snapshotPool);
+  poolDrain(&materialPagePool);
+  poolDrain(&transactionPagePool);
+}
+
+// ======= Scratch arena =======
+void *arenaAlloc(size_t size) {
+  size_t align = sizeof(max_align_t);
+  size_t rounded = (size + align - 1) / align * align;
+  scratch.allocations++;
+
+  if (rounded <= sizeof(scratchMemory) - scratch.used) {
+    void *p = (char *)scratchMemory + scratch.used;
+    scratch.used += rounded;
+    if (scratch.used > scratch.peak) {
+      scratch.peak = scratch.used;
+    }
+    return p;
+  }
+
+  // does not fit: take it from the heap until the next reset
+  ArenaBlock *block = heapAlloc(sizeof(ArenaBlock) + rounded);
+  if (block == NULL) {
+    return NULL;
+  }
+  block->next = scratch.overflow;
+  scratch.overflow = block;
+  scratch.heapFallbacks++;
+  return block->data;
+}
+
+// end of a command: everything handed out since the last reset is dropped
+void arenaReset() {
+  while (scratch.overflow != NULL) {
+    ArenaBlock *next = scratch.overflow->next;
+    free(scratch.overflow);
+    scratch.overflow = next;
+  }
+  scratch.used = 0;
+  scratch.resets++;
+}